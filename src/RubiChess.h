@@ -52,6 +52,10 @@
 #define NNUE
 #endif
 
+#if 1
+#define LOCKLESSHASH
+#endif
+
 #ifdef FINDMEMORYLEAKS
 #ifdef _DEBUG  
 #define DEBUG_CLIENTBLOCK   new( _CLIENT_BLOCK, __FILE__, __LINE__)  
@@ -84,6 +88,9 @@
 #include <algorithm>
 #include <iterator>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include <map>
 #include <time.h>
 #include <array>
@@ -246,7 +253,7 @@ typedef unsigned int PieceCode;
 typedef unsigned int PieceType;
 
 // Forward definitions
-class transposition;
+template <int BucketNum> class transposition_t;
 class chessposition;
 class searchthread;
 struct pawnhashentry;
@@ -602,7 +609,7 @@ const int NnueClippingShift = 6;
 const int NnueValueScale = 16;
 
 #if (defined(USE_SSE2) || defined(USE_MMX)) && !defined(USE_SSSE3)
-// FIXME: This is not implemented yet
+// Without SSSE3 (maddubs) the inputs of the hidden layers are 16bit
 typedef int16_t clipped_t;
 typedef int16_t weight_t;
 #else
@@ -625,6 +632,26 @@ typedef struct {
 
 
 extern bool NnueReady;
+extern bool NnueEndgameReady;
+#ifdef NNUEBENCH
+extern bool NnueBenchRecording;
+#endif
+
+// Nets that are loaded at the same time; builds with NNUEENDGAME (make NNUEENDGAMENET=1) support
+// an endgame net that replaces the main net in positions with few pieces
+#ifdef NNUEENDGAME
+#define NNUEMAXNETS 2
+#else
+#define NNUEMAXNETS 1
+#endif
+#define NNUEMAINNET 0
+#define NNUEENDGAMENET 1
+
+#ifdef NNUEINCLUDED
+#define NNUEDEFAULTNET "<Default>"
+#else
+#define NNUEDEFAULTNET "./default.nnue"
+#endif
 
 
 class NnueLayer
@@ -633,10 +660,11 @@ public:
     NnueLayer* previous;
 
     NnueLayer(NnueLayer* prev) { previous = prev; }
-    virtual bool ReadWeights(ifstream* is) = 0;
+    virtual bool ReadWeights(istream* is) = 0;
     virtual uint32_t GetHash() = 0;
 };
 
+// The weights of all layers are in one memory block; AssignWeights sets the pointers of the layer into this block
 class NnueFeatureTransformer : public NnueLayer
 {
 public:
@@ -644,9 +672,10 @@ public:
     int16_t* weight;
 
     NnueFeatureTransformer();
-    virtual ~NnueFeatureTransformer();
-    bool ReadWeights(ifstream* is);
+    virtual ~NnueFeatureTransformer() {};
+    bool ReadWeights(istream* is);
     uint32_t GetHash();
+    size_t AssignWeights(char *base, size_t offset);
 };
 
 class NnueClippedRelu : public NnueLayer
@@ -655,7 +684,7 @@ public:
     int dims;
     NnueClippedRelu(NnueLayer* prev, int d);
     virtual ~NnueClippedRelu() {};
-    bool ReadWeights(ifstream* is);
+    bool ReadWeights(istream* is);
     uint32_t GetHash();
     void Propagate(int32_t *input, clipped_t *output);
 };
@@ -667,7 +696,7 @@ public:
 
     NnueInputSlice();
     virtual ~NnueInputSlice() {};
-    bool ReadWeights(ifstream* is);
+    bool ReadWeights(istream* is);
     uint32_t GetHash();
 };
 
@@ -679,26 +708,86 @@ public:
 
     int32_t* bias;
     int8_t* weight;
+    // weights transposed to [input chunk of 4][output][4] for layers with sparse input
+    bool sparse;
+    int8_t* sparseweight;
 
-    NnueNetworkLayer(NnueLayer* prev, int id, int od);
-    virtual ~NnueNetworkLayer();
-    bool ReadWeights(ifstream* is);
+    NnueNetworkLayer(NnueLayer* prev, int id, int od, bool sp = false);
+    virtual ~NnueNetworkLayer() {};
+    bool ReadWeights(istream* is);
     uint32_t GetHash();
+    size_t AssignWeights(char *base, size_t offset);
+    void TransposeWeights();
     void Propagate(clipped_t *input, int32_t *output);
+    void PropagateSparse(clipped_t *input, int32_t *output);
 };
 
 class NnueAccumulator
 {
 public:
-    alignas(64) int16_t accumulation[2][256];
+    alignas(64) int16_t accumulation[NNUEMAXNETS][2][256];
     int score;
-    int computationState;
+    int computationState;   // bit n is set if the accumulation of net n is computed
 };
 
+// Cache of the last accumulator half and the pieces it was computed for per perspective and king square.
+// A refresh after a king move becomes an update against the cached position ("Finny table").
+class NnueFinnyEntry
+{
+public:
+    alignas(64) int16_t accumulation[256];
+    U64 piece00[14];
+    bool valid;
+};
+
+class NnueFinnyTable
+{
+public:
+    NnueFinnyEntry entry[2][64];
+    int netgeneration;
+};
+
+// A complete network: the layers and the memory block with all their weights.
+// There are two of them, so a new net can be loaded while the search keeps using the active one.
+class NnueNet
+{
+public:
+    NnueFeatureTransformer* Ft;
+    NnueInputSlice* In;
+    NnueNetworkLayer *Hd1, *Hd2, *Out;
+    NnueClippedRelu *Cl1, *Cl2;
+    // Allocated block for a parsed net file or pointer into a read-only mapping of a prepared net file (or the embedded net)
+    char* weights;
+    char* weightsAlloc;
+    void* mapping;
+    size_t mappingSize;
+
+    NnueNet();
+    ~NnueNet();
+    size_t AssignWeights(char *base);
+    void FreeWeights();
+    bool ParseNet(const char *data, size_t datasize);
+    bool UseMappedNet(const char *data, size_t datasize);
+    bool ReadNet(string path);
+    bool WriteMappedNet(string path);
+};
+
+extern int NnueNetGeneration[NNUEMAXNETS];
+extern atomic<NnueNet*> NnueActiveNet[NNUEMAXNETS];
+
 
 void NnueInit();
 void NnueRemove();
-void NnueReadNet(string path);
+void NnueReadNet(string path, int slot);
+void NnueLoadNetAsync(string path, int slot);
+void NnueWaitForLoad();
+bool NnueSwapNet(int slot);
+bool NnueWriteMappedNet(string path);
+void NnueEvalBatch(int slot, clipped_t *input, int n, int *scores);
+void NnueEvalBatchFile(string fenfile, string outfile);
+#ifdef NNUEBENCH
+void NnueBenchReplay();
+#endif
 
 
 
@@ -730,13 +819,15 @@ public:
     u8 getMaterialHash(chessposition *pos);
 };
 
+#ifndef TTBUCKETNUM
 #define TTBUCKETNUM 3
+#endif
 
 typedef uint16_t hashupper_t;
 #define GETHASHUPPER(x) (hashupper_t)((x) >> (64 - sizeof(hashupper_t) * 8))
 
-struct transpositionentry {
-    hashupper_t hashupper;
+// The data part of an entry is read and written as one 64bit word
+struct alignas(8) transpositionentry {
     uint16_t movecode;
     int16_t value;
     int16_t staticeval;
@@ -744,9 +835,38 @@ struct transpositionentry {
     uint8_t boundAndAge;
 };
 
-struct transpositioncluster {
-    transpositionentry entry[TTBUCKETNUM];
-    uint8_t padding[(64 - sizeof(transpositionentry) * TTBUCKETNUM) % 16];
+#ifdef LOCKLESSHASH
+// The key is stored xor'ed with the folded data; an entry mixed up by concurrent writes of two threads
+// passes the key check only with the same 1/65536 chance as any other foreign entry
+#define HASHKEYXOR(d) ((hashupper_t)((d) ^ ((d) >> 16) ^ ((d) >> 32) ^ ((d) >> 48)))
+#else
+#define HASHKEYXOR(d) ((hashupper_t)0)
+#endif
+
+// Up to 3 entries fit into a half cache line, up to 6 entries into a full cache line
+#define TTENTRYBYTES (sizeof(transpositionentry) + sizeof(hashupper_t))
+#define TTCLUSTERBYTES(n) ((n) * TTENTRYBYTES <= 32 ? 32 : 64)
+
+template <int BucketNum>
+struct transpositioncluster_t {
+    static_assert(BucketNum > 0 && BucketNum * TTENTRYBYTES <= 64, "Cluster doesn't fit into a cache line");
+    static_assert(sizeof(atomic<U64>) == sizeof(transpositionentry) && sizeof(atomic<hashupper_t>) == sizeof(hashupper_t), "atomic entry size mismatch");
+    // entries are shared by all threads; relaxed atomic accesses avoid a data race and torn words
+    atomic<U64> entry[BucketNum];
+    atomic<hashupper_t> hashupper[BucketNum];
+    uint8_t padding[TTCLUSTERBYTES(BucketNum) - TTENTRYBYTES * BucketNum];
+    // copies entry i to e and returns its key; 0 for an empty entry
+    hashupper_t load(int i, transpositionentry *e) {
+        U64 d = entry[i].load(memory_order_relaxed);
+        memcpy(e, &d, sizeof(d));
+        return hashupper[i].load(memory_order_relaxed) ^ HASHKEYXOR(d);
+    }
+    void store(int i, hashupper_t key, transpositionentry *e) {
+        U64 d;
+        memcpy(&d, e, sizeof(d));
+        entry[i].store(d, memory_order_relaxed);
+        hashupper[i].store(key ^ HASHKEYXOR(d), memory_order_relaxed);
+    }
 #ifdef SDEBUG
     U64 debugHash;
     int debugIndex;
@@ -754,18 +874,59 @@ struct transpositioncluster {
 #endif
 };
 
+typedef transpositioncluster_t<TTBUCKETNUM> transpositioncluster;
+
 
 #define FIXMATESCOREPROBE(v,p) (MATEFORME(v) ? (v) - p : (MATEFOROPPONENT(v) ? (v) + p : v))
 #define FIXMATESCOREADD(v,p) (MATEFORME(v) ? (v) + p : (MATEFOROPPONENT(v) ? (v) - p : v))
 
-class transposition
+#ifdef STATISTICS
+// Counters for hash usage; each thread has its own set
+struct ttstatistics {
+    U64 probes;
+    U64 hits;
+    U64 stores;
+    U64 storesEmpty;
+    U64 storesUpdate;
+    U64 storesReplace;
+    U64 storesRefused;
+    U64 badMoves;   // stored move not pseudo-legal in the probed position, a sure collision
+};
+
+extern thread_local ttstatistics *ttstats;
+#define TTSTATSINC(x)   ttstats->x++
+#else
+#define TTSTATSINC(x)
+#endif
+
+// jobs on the hash table running in parallel on the search threads
+#define TTJOBCLEAN    0
+#define TTJOBTRANSFER 1
+
+// kind of memory backing the hash table
+#define TTBACKINGPLAIN  0
+#define TTBACKINGTHP    1
+#define TTBACKINGHUGE2M 2
+#define TTBACKINGHUGE1G 3
+
+template <int BucketNum>
+class transposition_t
 {
 public:
-    transpositioncluster *table;
+    transpositioncluster_t<BucketNum> *table;
     U64 size;
     U64 sizemask;
     int numOfSearchShiftTwo;
-    ~transposition();
+    size_t allocsize;
+    int backing;
+    transpositioncluster_t<BucketNum> *oldtable;
+    U64 oldsize;
+    int jobType;
+    ~transposition_t();
+    void freeTable();
+    bool allocTable(U64 newsize);
+    void runJob(int job);
+    void doJobSlice(int index, int num);
     int setSize(int sizeMb);    // returns the number of Mb not used by allignment
     void clean();
     void addHash(U64 hash, int val, int16_t staticeval, int bound, int depth, uint16_t movecode);
@@ -773,6 +934,10 @@ public:
     bool probeHash(U64 hash, int *val, int *staticeval, uint16_t *movecode, int depth, int alpha, int beta, int ply);
     uint16_t getMoveCode(U64 hash);
     unsigned int getUsedinPermill();
+    bool saveToFile(string filename);
+    bool loadFromFile(string filename);
+    void printStatistics(U64 samples);
+    void resetStatistics();
     void nextSearch() { numOfSearchShiftTwo = (numOfSearchShiftTwo + 4) & 0xfc; }
 #ifdef SDEBUG
     void markDebugSlot(U64 h, int i) {
@@ -780,12 +945,12 @@ public:
     }
     int isDebugPosition(U64 h) { return (h != table[h & sizemask].debugHash) ? -1 : table[h & sizemask].debugIndex; }
     string debugGetPv(U64 h) {
-        transpositioncluster* data = &table[h & sizemask];
-        for (int i = 0; i < TTBUCKETNUM; i++)
+        transpositioncluster_t<BucketNum>* data = &table[h & sizemask];
+        for (int i = 0; i < BucketNum; i++)
         {
-            transpositionentry *e = &(data->entry[i]);
-            if (e->hashupper == GETHASHUPPER(h))
-                return "Depth=" + to_string(e->depth) + " Value=" + to_string(e->value) + "(" + to_string(e->boundAndAge & BOUNDMASK) + ")  pv=" + data->debugStoredBy;
+            transpositionentry e;
+            if (data->load(i, &e) == GETHASHUPPER(h))
+                return "Depth=" + to_string(e.depth) + " Value=" + to_string(e.value) + "(" + to_string(e.boundAndAge & BOUNDMASK) + ")  pv=" + data->debugStoredBy;
         }
         return "";
     }
@@ -797,6 +962,8 @@ public:
 #endif
 };
 
+typedef transposition_t<TTBUCKETNUM> transposition;
+
 
 typedef struct pawnhashentry {
     uint32_t hashupper;
@@ -1215,6 +1382,67 @@ enum PvAbortType {
     PVA_FUTILITYPRUNED, PVA_SEEPRUNED, PVA_BADHISTORYPRUNED, PVA_MULTICUT, PVA_BESTMOVE, PVA_NOTBESTMOVE, PVA_OMITTED, PVA_BETACUT, PVA_BELOWALPHA }; 
 #endif
 
+//
+// statistics stuff
+//
+#ifdef STATISTICS
+struct statistic {
+    U64 qs_n[2];                // total calls to qs split into no check / check
+    U64 qs_tt;                  // qs hits tt
+    U64 qs_pat;                 // qs returns with pat score
+    U64 qs_delta;               // qs return with delta pruning before move loop
+    U64 qs_loop_n;              // qs enters moves loop
+    U64 qs_move_delta;          // qs moves delta-pruned
+    U64 qs_moves;               // moves done in qs
+    U64 qs_moves_fh;            // qs moves that cause a fail high
+
+    U64 ab_n;                   // total calls to alphabeta
+    U64 ab_pv;                  // number of PV nodes
+    U64 ab_tt;                  // alphabeta exit by tt hit
+    U64 ab_draw_or_win;         // alphabeta returns draw or mate score
+    U64 ab_qs;                  // alphabeta calls qsearch
+    U64 ab_tb;                  // alphabeta exits with tb score
+
+    U64 prune_futility;         // nodes pruned by reverse futility
+    U64 prune_nm;               // nodes pruned by null move;
+    U64 prune_probcut;          // nodes pruned by PobCut
+    U64 prune_multicut;         // nodes pruned by Multicut (detected by failed singular test)
+
+    U64 moves_loop_n;           // counts how often the moves loop is entered
+    U64 moves_n[2];             // all moves in alphabeta move loop split into quites ans tactical
+    U64 moves_pruned_lmp;       // moves pruned by lmp
+    U64 moves_pruned_futility;  // moves pruned by futility
+    U64 moves_pruned_badsee;    // moves pruned by bad see
+    U64 moves_played[2];        // moves that are played split into quites ans tactical
+    U64 moves_fail_high;        // moves that cause a fail high;
+    U64 moves_bad_hash;         // hash moves that are repicked in the bad tactical stage
+
+    U64 red_total;              // total reductions
+    U64 red_lmr[2];             // total late-move-reductions for (not) improved moves
+    U64 red_pi[2];              // number of quiets moves that are reduced split into (not) / improved moves
+    S64 red_history;            // total reduction by history
+    S64 red_pv;                 // total reduction by pv nodes
+    S64 red_correction;         // total reduction correction by over-/underflow
+
+    U64 extend_singular;        // total singular extensions
+    U64 extend_endgame;        // total endgame extensions
+    U64 extend_history;        // total history extensions
+};
+
+void search_statistics();
+
+// some macros to limit the ifdef STATISTICS inside the code
+// the counters are members of the threads chessposition and only collected if UCI option Statistics is enabled
+#define STATISTICSINC(x)        if (en.collectStatistics) statistics.x++
+#define STATISTICSADD(x, v)     if (en.collectStatistics) statistics.x += (v)
+#define STATISTICSDO(x)         x
+
+#else
+#define STATISTICSINC(x)
+#define STATISTICSADD(x, v)
+#define STATISTICSDO(x)
+#endif
+
 // Replace the occupied bitboards with the first two so far unused piece bitboards
 #define occupied00 piece00
 
@@ -1244,9 +1472,6 @@ public:
     U64 kingPinned;
 
     uint8_t mailbox[BOARDSIZE]; // redundand for faster "which piece is on field x"
-    chessmovestack movestack[MAXDEPTH];
-    uint16_t excludemovestack[MAXDEPTH];
-    int16_t staticevalstack[MAXDEPTH];
 
     int rootheight; // fixed stack offset in root position 
     int seldepth;
@@ -1257,24 +1482,15 @@ public:
     int bestmovescore[MAXMULTIPV];
     int lastbestmovescore;
     chessmove pondermove;
-    int LegalMoves[MAXDEPTH];
-    uint32_t killer[MAXDEPTH][2];
     uint32_t bestFailingLow;
     int threadindex;
     int psqval;
-    uint32_t pvtable[MAXDEPTH][MAXDEPTH];
-    uint32_t multipvtable[MAXMULTIPV][MAXDEPTH];
-    uint32_t lastpv[MAXDEPTH];
     int ph; // to store the phase during different evaluation functions
     int sc; // to stor scaling factor used for evaluation
     int useTb;
     int useRootmoveScore;
     int tbPosition;
     chessmove defaultmove; // fallback if search in time trouble didn't finish a single iteration
-    chessmovelist captureslist[MAXDEPTH];
-    chessmovelist quietslist[MAXDEPTH];
-    chessmovelist singularcaptureslist[MAXDEPTH];   // extra move lists for singular testing
-    chessmovelist singularquietslist[MAXDEPTH];
 #ifdef EVALTUNE
     bool isQuiet;
     bool noQs;
@@ -1293,6 +1509,22 @@ public:
     } pvdebug[MAXDEPTH];
 #endif
     // The following part of the chessposition object isn't copied from rootposition object to the threads positions
+    // The search stacks are several MB; only the game history part of movestack (up to mstop) is copied separately
+    chessmovestack movestack[MAXDEPTH];
+    uint16_t excludemovestack[MAXDEPTH];
+    int16_t staticevalstack[MAXDEPTH];
+    int LegalMoves[MAXDEPTH];
+    uint32_t killer[MAXDEPTH][2];
+    uint32_t pvtable[MAXDEPTH][MAXDEPTH];
+    uint32_t multipvtable[MAXMULTIPV][MAXDEPTH];
+    uint32_t lastpv[MAXDEPTH];
+    chessmovelist captureslist[MAXDEPTH];
+    chessmovelist quietslist[MAXDEPTH];
+    chessmovelist singularcaptureslist[MAXDEPTH];   // extra move lists for singular testing
+    chessmovelist singularquietslist[MAXDEPTH];
+#ifdef STATISTICS
+    alignas(64) statistic statistics;
+#endif
     int16_t history[2][64][64];
     int16_t counterhistory[14][64][14 * 64];
     uint32_t countermove[14][64];
@@ -1314,6 +1546,7 @@ public:
 #ifdef NNUE
     NnueAccumulator accumulator[MAXDEPTH];
     DirtyPiece dirtypiece[MAXDEPTH];
+    NnueFinnyTable finnytable[NNUEMAXNETS];
 #endif
     bool w2m();
     void BitboardSet(int index, PieceCode p);
@@ -1373,14 +1606,16 @@ public:
     int testRepetiton();
     void mirror();
 #ifdef NNUE
-    void HalfkpAppendActiveIndices(int c, NnueIndexList *active);
-    void AppendActiveIndices(NnueIndexList active[2]);
-    void HalfkpAppendChangedIndices(int c, NnueIndexList *add, NnueIndexList *remove);
-    void AppendChangedIndices(NnueIndexList add[2], NnueIndexList remove[2], bool reset[2]);
-    void RefreshAccumulator();
-    bool UpdateAccumulator();
-    void Transform(clipped_t *output);
+    void HalfkpAppendChangedIndices(int c, DirtyPiece *dp, NnueIndexList *add, NnueIndexList *remove);
+    void RefreshFromCache(int slot, int c, int16_t *accumulation);
+    void RefreshAccumulator(int slot);
+    bool UpdateAccumulator(int slot);
+    void Transform(int slot, clipped_t *output);
+    int NnueSelectNet();
     int NnueGetEval();
+#ifdef NNUEBENCH
+    void NnueBenchRecord(int slot);
+#endif
 #endif
 };
 
@@ -1388,7 +1623,7 @@ public:
 // uci stuff
 //
 
-enum GuiToken { UNKNOWN, UCI, UCIDEBUG, ISREADY, SETOPTION, REGISTER, UCINEWGAME, POSITION, GO, STOP, PONDERHIT, QUIT, EVAL, PERFT
+enum GuiToken { UNKNOWN, UCI, UCIDEBUG, ISREADY, SETOPTION, REGISTER, UCINEWGAME, POSITION, GO, STOP, PONDERHIT, QUIT, EVAL, PERFT, TTSTATS, EVALBATCH
 };
 
 const map<string, GuiToken> GuiCommandMap = {
@@ -1404,7 +1639,9 @@ const map<string, GuiToken> GuiCommandMap = {
     { "ponderhit", PONDERHIT },
     { "quit", QUIT },
     { "eval", EVAL },
-    { "perft", PERFT }
+    { "perft", PERFT },
+    { "ttstats", TTSTATS },
+    { "evalbatch", EVALBATCH }
 };
 
 //
@@ -1445,6 +1682,7 @@ typedef map<string, ucioption_t>::iterator optionmapiterator;
 #define ENGINETERMINATEDSEARCH 3
 
 #define NODESPERCHECK 0xfff
+#define NODESPERPUBLISH 0x3ff   // batch size - 1 for publishing the nodes of a thread to the global counter
 enum ponderstate_t { NO, PONDERING, HITPONDER };
 
 
@@ -1454,8 +1692,12 @@ enum ponderstate_t { NO, PONDERING, HITPONDER };
 #define CPUPOPCNT   (1 << 3)
 #define CPUAVX2     (1 << 4)
 #define CPUBMI2     (1 << 5)
+#define CPUAVX512   (1 << 6)
+#define CPUVNNI     (1 << 7)
+#define CPUNEON     (1 << 8)
+#define CPUDOTPROD  (1 << 9)
 
-#define STRCPUFEATURELIST  { "mmx","sse2","ssse3","popcnt","avx2","bmi2" }
+#define STRCPUFEATURELIST  { "mmx","sse2","ssse3","popcnt","avx2","bmi2","avx512","vnni","neon","dotprod" }
 
 
 extern const string strCpuFeatures[];
@@ -1481,6 +1723,18 @@ public:
 #endif
 #ifdef USE_BMI2
         | CPUBMI2
+#endif
+#ifdef USE_AVX512
+        | CPUAVX512
+#endif
+#ifdef USE_VNNI
+        | CPUVNNI
+#endif
+#ifdef USE_NEON
+        | CPUNEON
+#endif
+#ifdef USE_DOTPROD
+        | CPUDOTPROD
 #endif
         ;
 
@@ -1494,6 +1748,19 @@ public:
 };
 
 
+class numasystem
+{
+public:
+    int numOfNodes = 0;
+    vector<int> nodeId;
+    vector<vector<int>> nodeCpus;
+    void init();
+    int nodeOfThread(int index) { return numOfNodes ? index % numOfNodes : 0; }
+    bool bindThread(int index);
+    bool interleaveMemory(void *mem, size_t size);
+};
+
+
 class engine
 {
 public:
@@ -1512,12 +1779,19 @@ public:
     bool debug = false;
     bool evaldetails = false;
     bool moveoutput;
-    int stopLevel = ENGINETERMINATEDSEARCH;
+    // nodes of all threads published in batches; own cache line as it is written by all threads
+    alignas(64) atomic<U64> publishedNodes;
+    alignas(64) atomic<int> stopLevel { ENGINETERMINATEDSEARCH };
     int Hash;
+    string HashFile;
     int restSizeOfTp = 0;
     int sizeOfPh;
     int moveOverhead;
     int MultiPV;
+    bool abdada;
+#ifdef STATISTICS
+    bool collectStatistics;
+#endif
     bool ponder;
     bool chess960;
     string SyzygyPath;
@@ -1527,9 +1801,21 @@ public:
     int Threads;
     int oldThreads;
     searchthread *sthread;
+    // persistent pool of the search threads; idle threads wait for the next job
+    mutex poolMutex;
+    condition_variable poolWakeup;
+    condition_variable poolIdle;
+    void (*poolJob)(searchthread*) = nullptr;
+    int poolGeneration = 0;
+    int poolBusy = 0;
+    bool poolExit = false;
+    numasystem numa;
+    bool numaBind;
+    bool numaInterleaveHash;
     ponderstate_t pondersearch;
     bool ponderhit;
     int terminationscore = SHRT_MAX;
+    atomic<U64> rootHint;   // best root move of the deepest completed helper iteration: depth << 32 | movecode
     int lastReport;
     int benchdepth;
     string benchmove;
@@ -1546,6 +1832,8 @@ public:
 #endif
 #ifdef NNUE
     string NnueNetpath;
+    string NnueEndgameNetpath;
+    int NnueEndgamePieces;
 #endif
 
     string name() {
@@ -1556,10 +1844,18 @@ public:
     void send(const char* format, ...);
     void communicate(string inputstring);
     void allocThreads();
+    void startThreadPool();
+    void stopThreadPool();
+    void runOnThreads(void(*job)(searchthread*));
+    void waitForThreads();
     U64 getTotalNodes();
     long long perft(int depth, bool dotests);
     void prepareThreads();
     void resetStats();
+#ifdef NNUE
+    void swapNnueNet(bool wait);
+    void invalidateAccumulators();
+#endif
 };
 
 PieceType GetPieceType(char c);
@@ -1605,6 +1901,9 @@ public:
     int depth;
     int numofthreads;
     int lastCompleteDepth;
+#ifdef STATISTICS
+    ttstatistics ttstats;
+#endif
     // adjust padding to align searchthread at 64 bytes
     uint8_t padding[16];
 
@@ -1629,66 +1928,5 @@ int root_probe_dtz(chessposition *pos);
 int root_probe_wdl(chessposition *pos);
 
 
-//
-// statistics stuff
-//
-#ifdef STATISTICS
-struct statistic {
-    U64 qs_n[2];                // total calls to qs split into no check / check
-    U64 qs_tt;                  // qs hits tt
-    U64 qs_pat;                 // qs returns with pat score
-    U64 qs_delta;               // qs return with delta pruning before move loop
-    U64 qs_loop_n;              // qs enters moves loop
-    U64 qs_move_delta;          // qs moves delta-pruned
-    U64 qs_moves;               // moves done in qs
-    U64 qs_moves_fh;            // qs moves that cause a fail high
-
-    U64 ab_n;                   // total calls to alphabeta
-    U64 ab_pv;                  // number of PV nodes
-    U64 ab_tt;                  // alphabeta exit by tt hit
-    U64 ab_draw_or_win;         // alphabeta returns draw or mate score
-    U64 ab_qs;                  // alphabeta calls qsearch
-    U64 ab_tb;                  // alphabeta exits with tb score
-
-    U64 prune_futility;         // nodes pruned by reverse futility
-    U64 prune_nm;               // nodes pruned by null move;
-    U64 prune_probcut;          // nodes pruned by PobCut
-    U64 prune_multicut;         // nodes pruned by Multicut (detected by failed singular test)
-
-    U64 moves_loop_n;           // counts how often the moves loop is entered
-    U64 moves_n[2];             // all moves in alphabeta move loop split into quites ans tactical
-    U64 moves_pruned_lmp;       // moves pruned by lmp
-    U64 moves_pruned_futility;  // moves pruned by futility
-    U64 moves_pruned_badsee;    // moves pruned by bad see
-    U64 moves_played[2];        // moves that are played split into quites ans tactical
-    U64 moves_fail_high;        // moves that cause a fail high;
-    U64 moves_bad_hash;         // hash moves that are repicked in the bad tactical stage
-
-    U64 red_total;              // total reductions
-    U64 red_lmr[2];             // total late-move-reductions for (not) improved moves
-    U64 red_pi[2];              // number of quiets moves that are reduced split into (not) / improved moves
-    S64 red_history;            // total reduction by history
-    S64 red_pv;                 // total reduction by pv nodes
-    S64 red_correction;         // total reduction correction by over-/underflow
-
-    U64 extend_singular;        // total singular extensions
-    U64 extend_endgame;        // total endgame extensions
-    U64 extend_history;        // total history extensions
-};
-
-extern struct statistic statistics;
-
-void search_statistics();
-
-// some macros to limit the ifdef STATISTICS inside the code
-#define STATISTICSINC(x)        statistics.x++ 
-#define STATISTICSADD(x, v)     statistics.x += (v)
-#define STATISTICSDO(x)         x
-
-#else
-#define STATISTICSINC(x)
-#define STATISTICSADD(x, v)
-#define STATISTICSDO(x)
-#endif
 
 
@@ -436,6 +436,9 @@ int chessposition::getFromFen(const char* sFen)
     mstop = 0;
     rootheight = 0;
     lastnullmove = -1;
+#ifdef NNUE
+    accumulator[0].computationState = 0;
+#endif
     return 0;
 }
 
@@ -470,6 +473,9 @@ uint32_t chessposition::applyMove(string s, bool resetMstop)
         {
             // Keep the list short, we have to keep below MAXMOVELISTLENGTH
             mstop = 0;
+#ifdef NNUE
+            accumulator[0].computationState = 0;
+#endif
         }
         return m.code;
     }
@@ -712,11 +718,9 @@ void chessposition::playNullMove()
     ply++;
     myassert(mstop <= MAXDEPTH, this, 1, mstop);
 #ifdef NNUE
-    if (accumulator[mstop - 1].computationState)
-        accumulator[mstop] = accumulator[mstop - 1];
-    else
-        accumulator[mstop].computationState = 0;
-
+    // no piece changes; the accumulator is computed lazily from the parent
+    dirtypiece[mstop].dirtyNum = 0;
+    accumulator[mstop].computationState = 0;
 #endif
 }
 
@@ -2305,6 +2309,10 @@ void MoveSelector::SetPreferredMoves(chessposition *p, uint16_t hshm, uint32_t k
 {
     pos = p;
     hashmove.code = p->shortMove2FullMove(hshm);
+#ifdef STATISTICS
+    if (hshm && !hashmove.code)
+        ttstats->badMoves++;
+#endif
     if (kllm1 != hashmove.code)
         killermove1.code = kllm1;
     if (kllm2 != hashmove.code)
@@ -2408,7 +2416,7 @@ chessmove* MoveSelector::next()
             bool bBadTactical = (m->value & BADTACTICALFLAG);
             m->value = INT_MIN;
             if (bBadTactical) {
-                STATISTICSDO(if (m->code == hashmove.code) STATISTICSINC(moves_bad_hash));
+                STATISTICSDO(if (m->code == hashmove.code && en.collectStatistics) pos->statistics.moves_bad_hash++);
                 return m;
             }
         }
@@ -2455,22 +2463,145 @@ static void uciSetHash()
     }
 }
 
+static void uciSetNuma()
+{
+    if (en.numaBind)
+    {
+        if (en.numa.numOfNodes < 2)
+            cout << "info string NUMA: Only one node found. Threads are not bound.\n";
+        else
+            cout << "info string NUMA: Binding " << en.Threads << " threads to " << en.numa.numOfNodes << " nodes.\n";
+    }
+    en.allocThreads();
+}
+
+static void uciSetNumaInterleaveHash()
+{
+    if (en.numaInterleaveHash && en.numa.numOfNodes < 2)
+        cout << "info string NUMA: Only one node found. Hash is not interleaved.\n";
+    if (tp.size)
+        // reallocate the hash to apply the memory policy
+        tp.setSize(en.Hash);
+}
+
 static void uciClearHash()
 {
     tp.clean();
 }
 
+static void uciSaveHash()
+{
+    if (tp.saveToFile(en.HashFile))
+        cout << "info string Hash saved to " << en.HashFile << ".\n";
+    else
+        cout << "info string Cannot save hash to " << en.HashFile << ".\n";
+}
+
+static void uciLoadHash()
+{
+    U64 oldsize = tp.size;
+    bool success = tp.loadFromFile(en.HashFile);
+    if (tp.size != oldsize)
+    {
+        // table was resized to the size of the file
+        en.Hash = (int)((tp.size * sizeof(transpositioncluster)) >> 20);
+        if (en.restSizeOfTp)
+        {
+            en.restSizeOfTp = 0;
+            uciSetThreads();
+        }
+    }
+    if (success)
+        cout << "info string Hash loaded from " << en.HashFile << " (" << en.Hash << " MB).\n";
+    else
+        cout << "info string Cannot load hash from " << en.HashFile << ".\n";
+}
+
 static void uciSetSyzygyPath()
 {
     init_tablebases((char*)en.SyzygyPath.c_str());
 }
 
 #ifdef NNUE
+static bool isNnueNetpathOption(string name)
+{
+    transform(name.begin(), name.end(), name.begin(), ::tolower);
+    return name == "nnuenetpath" || name == "nnueendgamenetpath";
+}
+
+static string nnueNetName(int slot)
+{
+    return (slot == NNUEMAINNET ? "net " + en.NnueNetpath : "endgame net " + en.NnueEndgameNetpath);
+}
+
+static string nnueNetUsage(int slot)
+{
+    if (slot == NNUEMAINNET)
+        return (NnueReady ? "Using NNUE evaluation." : "Using handcrafted evaluation.");
+    return (NnueEndgameReady ? "Using it for positions with up to " + to_string(en.NnueEndgamePieces) + " pieces." : "Using the main net for all positions.");
+}
+
+static void uciLoadNnueNet(int slot)
+{
+    string path = (slot == NNUEMAINNET ? en.NnueNetpath : en.NnueEndgameNetpath);
+    bool verbose = (path != "<empty>");
+    if (en.stopLevel != ENGINETERMINATEDSEARCH)
+    {
+        // the running search continues with the current net; the new one is activated after it
+        if (verbose)
+            cout << "info string Loading " << nnueNetName(slot) << " in the background.\n";
+        NnueLoadNetAsync(path, slot);
+        return;
+    }
+    if (verbose)
+        cout << "info string Loading " << nnueNetName(slot) << " ...";
+    NnueReadNet(path, slot);
+    bool ready = (slot == NNUEMAINNET ? NnueReady : NnueEndgameReady);
+    if (verbose)
+        cout << (ready ? " successful. " : " failed. ") << nnueNetUsage(slot) << "\n";
+    en.invalidateAccumulators();
+}
+
 static void uciSetNnuePath()
 {
-    cout << "info string Loading net " << en.NnueNetpath << " ...";
-    NnueReadNet(en.NnueNetpath);
-    cout << (NnueReady ? " successful. Using NNUE evaluation." : " failed. Using handcrafted evaluation.") << "\n";
+    uciLoadNnueNet(NNUEMAINNET);
+}
+
+#ifdef NNUEENDGAME
+static void uciSetNnueEndgamePath()
+{
+    uciLoadNnueNet(NNUEENDGAMENET);
+}
+#endif
+
+// Activate nets that were loaded in the background; called at a search boundary
+void engine::swapNnueNet(bool wait)
+{
+    if (wait)
+        NnueWaitForLoad();
+    bool swapped = false;
+    for (int slot = 0; slot < NNUEMAXNETS; slot++)
+    {
+        if (!NnueSwapNet(slot))
+            continue;
+        swapped = true;
+        bool ready = (slot == NNUEMAINNET ? NnueReady : NnueEndgameReady);
+        if (ready)
+            cout << "info string Switched to " << nnueNetName(slot) << ". " << nnueNetUsage(slot) << "\n";
+        else if (slot == NNUEMAINNET || NnueEndgameNetpath != "<empty>")
+            cout << "info string Loading " << nnueNetName(slot) << " failed. " << nnueNetUsage(slot) << "\n";
+    }
+    if (swapped)
+        invalidateAccumulators();
+}
+
+// Accumulators of the root and the threads positions were computed with the old net
+void engine::invalidateAccumulators()
+{
+    for (int j = 0; j <= rootposition.mstop; j++)
+        rootposition.accumulator[j].computationState = 0;
+    if (sthread)
+        prepareThreads();
 }
 #endif
 
@@ -2493,19 +2624,33 @@ engine::engine(compilerinfo *c)
     NnueInit();
 #endif
     rootposition.pwnhsh.setSize(1);  // some dummy pawnhash just to make the prefetch in playMove happy
-    
+    numa.init();
+
+    ucioptions.Register(&numaBind, "NUMA", ucicheck, "false", 0, 0, uciSetNuma);   // before Threads and Hash to avoid useless reallocation
+    ucioptions.Register(&numaInterleaveHash, "NUMAInterleaveHash", ucicheck, "false", 0, 0, uciSetNumaInterleaveHash);
     ucioptions.Register(&Threads, "Threads", ucispin, "1", 1, MAXTHREADS, uciSetThreads);  // order is important as the pawnhash depends on Threads > 0
     ucioptions.Register(&Hash, "Hash", ucispin, to_string(DEFAULTHASH), 1, MAXHASH, uciSetHash);
     ucioptions.Register(&moveOverhead, "Move Overhead", ucispin, "50", 0, 5000, nullptr);
     ucioptions.Register(&MultiPV, "MultiPV", ucispin, "1", 1, MAXMULTIPV, nullptr);
     ucioptions.Register(&ponder, "Ponder", ucicheck, "false");
+    ucioptions.Register(&abdada, "ABDADA", ucicheck, "false");
+#ifdef STATISTICS
+    ucioptions.Register(&collectStatistics, "Statistics", ucicheck, "false");
+#endif
     ucioptions.Register(&SyzygyPath, "SyzygyPath", ucistring, "<empty>", 0, 0, uciSetSyzygyPath);
     ucioptions.Register(&Syzygy50MoveRule, "Syzygy50MoveRule", ucicheck, "true");
     ucioptions.Register(&SyzygyProbeLimit, "SyzygyProbeLimit", ucispin, "7", 0, 7, nullptr);
     ucioptions.Register(&chess960, "UCI_Chess960", ucicheck, "false");
     ucioptions.Register(nullptr, "Clear Hash", ucibutton, "", 0, 0, uciClearHash);
+    ucioptions.Register(&HashFile, "HashFile", ucistring, "hash.bin", 0, 0, nullptr);
+    ucioptions.Register(nullptr, "Save Hash to File", ucibutton, "", 0, 0, uciSaveHash);
+    ucioptions.Register(nullptr, "Load Hash from File", ucibutton, "", 0, 0, uciLoadHash);
 #ifdef NNUE
-    ucioptions.Register(&NnueNetpath, "NNUENetpath", ucistring, "./default.nnue", 0, 0, uciSetNnuePath);
+    ucioptions.Register(&NnueNetpath, "NNUENetpath", ucistring, NNUEDEFAULTNET, 0, 0, uciSetNnuePath);
+#ifdef NNUEENDGAME
+    ucioptions.Register(&NnueEndgamePieces, "NNUEEndgamePieces", ucispin, "12", 3, 32, nullptr);
+    ucioptions.Register(&NnueEndgameNetpath, "NNUEEndgameNetpath", ucistring, "<empty>", 0, 0, uciSetNnueEndgamePath);
+#endif
 #endif
 #ifdef _WIN32
     LARGE_INTEGER f;
@@ -2529,8 +2674,102 @@ engine::~engine()
 }
 
 
+static void threadPoolIdleLoop(searchthread *thr, int index, int generation)
+{
+    if (en.numaBind)
+        en.numa.bindThread(index);
+
+    // Initialize the thread data inside the thread so that first touch puts it on the local NUMA node
+    memset((void*)&thr->pos, 0, sizeof(chessposition));
+    thr->index = index;
+    thr->depth = 0;
+    thr->lastCompleteDepth = 0;
+#ifdef STATISTICS
+    memset(&thr->ttstats, 0, sizeof(ttstatistics));
+    ttstats = &thr->ttstats;
+#endif
+    thr->searchthreads = en.sthread;
+    thr->numofthreads = en.Threads;
+    thr->pos.pwnhsh.setSize(en.sizeOfPh);
+    thr->pos.mtrlhsh.init();
+
+    unique_lock<mutex> lock(en.poolMutex);
+    if (--en.poolBusy == 0)
+        en.poolIdle.notify_all();
+
+    while (true)
+    {
+        // sleep until a new job is posted or the pool is shut down
+        en.poolWakeup.wait(lock, [generation] { return en.poolExit || en.poolGeneration != generation; });
+        if (en.poolExit)
+            return;
+        generation = en.poolGeneration;
+        void (*job)(searchthread*) = en.poolJob;
+        lock.unlock();
+
+        job(thr);
+
+        lock.lock();
+        if (--en.poolBusy == 0)
+            en.poolIdle.notify_all();
+    }
+}
+
+
+void engine::startThreadPool()
+{
+    unique_lock<mutex> lock(poolMutex);
+    poolExit = false;
+    poolBusy = Threads;
+    for (int i = 0; i < Threads; i++)
+        new (&sthread[i].thr) thread(&threadPoolIdleLoop, &sthread[i], i, poolGeneration);
+}
+
+
+void engine::stopThreadPool()
+{
+    {
+        unique_lock<mutex> lock(poolMutex);
+        poolIdle.wait(lock, [this] { return poolBusy == 0; });
+        poolExit = true;
+    }
+    poolWakeup.notify_all();
+    for (int i = 0; i < oldThreads; i++)
+    {
+        if (sthread[i].thr.joinable())
+            sthread[i].thr.join();
+        // the thread object was placement-new'd into the aligned searchthread memory
+        sthread[i].thr.~thread();
+    }
+}
+
+
+void engine::runOnThreads(void(*job)(searchthread*))
+{
+    {
+        unique_lock<mutex> lock(poolMutex);
+        // a job must not overlap with the previous one
+        poolIdle.wait(lock, [this] { return poolBusy == 0; });
+        poolJob = job;
+        poolBusy = Threads;
+        poolGeneration++;
+    }
+    poolWakeup.notify_all();
+}
+
+
+void engine::waitForThreads()
+{
+    unique_lock<mutex> lock(poolMutex);
+    poolIdle.wait(lock, [this] { return poolBusy == 0; });
+}
+
+
 void engine::allocThreads()
 {
+    // stop the old pool of searchthreads
+    stopThreadPool();
+
     // first cleanup the old searchthreads memory
     for (int i = 0; i < oldThreads; i++)
     {
@@ -2548,16 +2787,11 @@ void engine::allocThreads()
     size_t size = Threads * sizeof(searchthread);
     myassert(size % 64 == 0, nullptr, 1, size % 64);
 
+    // The threads initialize their own memory
     sthread = (searchthread*) allocalign64(size);
-    memset((void*)sthread, 0, size);
-    for (int i = 0; i < Threads; i++)
-    {
-        sthread[i].index = i;
-        sthread[i].searchthreads = sthread;
-        sthread[i].numofthreads = Threads;
-        sthread[i].pos.pwnhsh.setSize(sizeOfPh);
-        sthread[i].pos.mtrlhsh.init();
-    }
+    startThreadPool();
+    waitForThreads();
+
     prepareThreads();
     resetStats();
 }
@@ -2565,11 +2799,19 @@ void engine::allocThreads()
 
 void engine::prepareThreads()
 {
+    publishedNodes = 0;
     for (int i = 0; i < Threads; i++)
     {
         chessposition *pos = &sthread[i].pos;
-        // copy new position to the threads copy but keep old history data
-        memcpy((void*)pos, &rootposition, offsetof(chessposition, history));
+        // copy new position to the threads copy but keep old history data and the search stacks
+        memcpy((void*)pos, &rootposition, offsetof(chessposition, movestack));
+        memcpy(pos->movestack, rootposition.movestack, (rootposition.mstop + 1) * sizeof(chessmovestack));
+        memcpy(pos->staticevalstack, rootposition.staticevalstack, (rootposition.mstop + 1) * sizeof(int16_t));
+        // reset the stack entries that are read before the search writes them
+        memset(pos->excludemovestack, 0, sizeof(pos->excludemovestack));
+        memset(pos->LegalMoves, 0, sizeof(pos->LegalMoves));
+        memset(pos->killer, 0, sizeof(pos->killer));
+        pos->pvtable[0][0] = 0;
         pos->threadindex = i;
         // early reset of variables that are important for bestmove selection
         pos->bestmovescore[0] = NOSCORE;
@@ -2577,6 +2819,11 @@ void engine::prepareThreads()
         pos->nodes = 0;
         pos->nullmoveply = 0;
         pos->nullmoveside = 0;
+#ifdef NNUE
+        // accumulators and dirty pieces aren't copied from rootposition; invalidate what's left from the last search
+        for (int j = 0; j <= pos->mstop; j++)
+            pos->accumulator[j].computationState = 0;
+#endif
     }
 }
 
@@ -2655,6 +2902,11 @@ void engine::communicate(string inputstring)
             }
             if (pendingisready)
             {
+#ifdef NNUE
+                // wait for a net loading in the background unless this would block a running search
+                if (stopLevel == ENGINETERMINATEDSEARCH)
+                    swapNnueNet(true);
+#endif
                 send("readyok\n");
                 pendingisready = false;
             }
@@ -2666,6 +2918,10 @@ void engine::communicate(string inputstring)
             cs = commandargs.size();
             if (en.stopLevel == ENGINESTOPIMMEDIATELY)
                 searchWaitStop();
+#ifdef NNUE
+            if (stopLevel == ENGINETERMINATEDSEARCH)
+                swapNnueNet(false);
+#endif
             switch (command)
             {
             case UCIDEBUG:
@@ -2721,9 +2977,14 @@ void engine::communicate(string inputstring)
                 sthread[0].pos.lastbestmovescore = NOSCORE;
                 break;
             case SETOPTION:
-                if (en.stopLevel != ENGINETERMINATEDSEARCH)
+                if (en.stopLevel != ENGINETERMINATEDSEARCH
+#ifdef NNUE
+                    // a new net can be loaded while searching
+                    && !(cs > 1 && isNnueNetpathOption(commandargs[1]))
+#endif
+                    )
                 {
-                    send("info string Changing option while searching is not supported. stopLevel = %d\n", en.stopLevel);
+                    send("info string Changing option while searching is not supported. stopLevel = %d\n", en.stopLevel.load());
                     break;
                 }
                 bGetName = bGetValue = false;
@@ -2891,6 +3152,28 @@ void engine::communicate(string inputstring)
                 en.evaldetails = (ci < cs && commandargs[ci] == "detail");
                 sthread[0].pos.getEval<TRACE>();
                 break;
+            case TTSTATS:
+            {
+                U64 samples = 0x100000;
+                if (ci < cs)
+                {
+                    const char *arg = commandargs[ci].c_str();
+                    char *end;
+                    long long n = strtoll(arg, &end, 10);
+                    if (end == arg || *end || n <= 0)
+                        cout << "info string Usage: ttstats [number of sampled clusters > 0]; sampling " << samples << " clusters.\n";
+                    else
+                        samples = n;
+                }
+                tp.printStatistics(samples);
+                break;
+            }
+#ifdef NNUE
+            case EVALBATCH:
+                if (ci < cs)
+                    NnueEvalBatchFile(commandargs[ci], ci + 1 < cs ? commandargs[ci + 1] : commandargs[ci] + ".eval");
+                break;
+#endif
             case PERFT:
                 if (ci < cs) {
                     maxdepth = stoi(commandargs[ci++]);
@@ -906,6 +906,13 @@ int main(int argc, char* argv[])
     string logfile;
     string comparefile;
     string genepd;
+#ifdef NNUE
+    string mappednetfile;
+    string evalbatchfile;
+#endif
+#ifdef NNUEBENCH
+    bool nnuebench;
+#endif
 #ifdef EVALTUNE
     string pgnconvertfile;
     string fentuningfiles;
@@ -940,6 +947,13 @@ int main(int argc, char* argv[])
         { "-flags", "1=skip easy (0 sec.) compares; 2=break 5 seconds after first find; 4=break after compare time is over; 8=eval only (use with -enginetest)", &flags, 1, "0" },
         { "-option", "Set UCI option by commandline", NULL, 3, NULL },
         { "-generate", "Generates epd file with n (default 1000) random endgame positions of the given type; format: egstr/n ", &genepd, 2, "" },
+#ifdef NNUE
+        { "-writemappednet", "writes the net (set with -option NNUENetpath) in a layout that can be mapped to memory directly", &mappednetfile, 2, "" },
+        { "-evalbatch", "evaluates all FENs of the given file with the net (set with -option NNUENetpath) and writes them with their score to <file>.eval", &evalbatchfile, 2, "" },
+#endif
+#ifdef NNUEBENCH
+        { "-nnuebench", "records the NNUE evaluations of the bench searches (use with -depth) and replays them to measure each kernel", &nnuebench, 0, NULL },
+#endif
 #ifdef STACKDEBUG
         { "-assertfile", "output assert info to file", &en.assertfile, 2, "" },
 #endif
@@ -1056,6 +1070,35 @@ int main(int argc, char* argv[])
     {
         generateEpd(genepd);
     }
+#ifdef NNUEBENCH
+    else if (nnuebench)
+    {
+        if (NnueReady)
+        {
+            NnueBenchRecording = true;
+            doBenchmark(depth, epdfile, maxtime, startnum, false);
+            NnueBenchRecording = false;
+            NnueBenchReplay();
+        }
+        else
+        {
+            cout << "-nnuebench needs a NNUE net.\n";
+        }
+    }
+#endif
+#ifdef NNUE
+    else if (evalbatchfile != "")
+    {
+        NnueEvalBatchFile(evalbatchfile, evalbatchfile + ".eval");
+    }
+    else if (mappednetfile != "")
+    {
+        if (NnueWriteMappedNet(mappednetfile))
+            cout << "Mapped net written to " << mappednetfile << "\n";
+        else
+            cout << "Cannot write mapped net to " << mappednetfile << "\n";
+    }
+#endif
 #ifdef EVALTUNE
     else if (pgnconvertfile != "")
     {
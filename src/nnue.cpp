@@ -26,7 +26,14 @@
 
 #ifdef NNUE
 
-#if defined(USE_AVX2)
+#ifndef _WIN32
+#include <sys/mman.h> // mmap
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if defined(USE_AVX2) || defined(USE_AVX512)
 #include <immintrin.h>
 
 #elif defined(USE_SSSE3)
@@ -71,37 +78,83 @@ uint32_t PieceToIndex[2][16] = {
 // Global objects
 //
 bool NnueReady = false;
-
-NnueInputSlice* NnueIn;
-NnueClippedRelu *NnueCl1, *NnueCl2;
-NnueNetworkLayer *NnueOut, *NnueHd1, *NnueHd2;
-NnueFeatureTransformer *NnueFt;
-
-
-//
-// NNUE interface in chessposition
-//
-void chessposition::HalfkpAppendActiveIndices(int c, NnueIndexList *active)
+bool NnueEndgameReady = false;
+#ifdef NNUEBENCH
+bool NnueBenchRecording = false;
+#endif
+int NnueNetGeneration[NNUEMAXNETS] = { 0 };
+
+// Two net objects per slot (main and endgame net).
+// The search uses the active one; a new net is loaded into the other one and activated between two searches
+static NnueNet* NnueNets[NNUEMAXNETS][2];
+atomic<NnueNet*> NnueActiveNet[NNUEMAXNETS];
+
+// State of the (background) loading of the standby net
+#define NNUELOADIDLE 0
+#define NNUELOADRUNNING 1
+#define NNUELOADSUCCESS 2
+#define NNUELOADFAILED 3
+static atomic<int> NnueLoadState[NNUEMAXNETS];
+static thread NnueLoadThread[NNUEMAXNETS];
+
+static inline NnueNet* NnueCurrentNet(int slot)
 {
-    int k = ORIENT(c, kingpos[c]);
-    U64 nonkingsbb = (occupied00[0] | occupied00[1]) & ~(piece00[WKING] | piece00[BKING]);
-    while (nonkingsbb)
-    {
-        int index = pullLsb(&nonkingsbb);
-        active->values[active->size++] = MAKEINDEX(c, index, mailbox[index], k);
-    }
+    return NnueActiveNet[slot].load(memory_order_acquire);
 }
 
-void chessposition::AppendActiveIndices(NnueIndexList active[2])
+static inline NnueNet* NnueStandbyNet(int slot)
 {
-    for (int c = 0; c < 2; c++)
-        HalfkpAppendActiveIndices(c, &active[c]);
+    return (NnueCurrentNet(slot) == NnueNets[slot][0] ? NnueNets[slot][1] : NnueNets[slot][0]);
 }
 
-void chessposition::HalfkpAppendChangedIndices(int c, NnueIndexList* add, NnueIndexList* remove)
+#define NNUEALIGN64(x) (((x) + 63) & ~(size_t)63)
+
+// Number of outputs the sparse propagation can handle in registers
+#define NNUESPARSEMAXOUTPUTS 32
+
+#if defined(USE_SSSE3) || defined(USE_NEON)
+// Layers with sparse input use the transposed weights
+#define NNUESPARSEPROPAGATE
+#endif
+
+// Header of a prepared net file that contains the weights in the runtime layout and can be mapped to memory directly
+#define NNUEMAPPEDMAGIC "RubiNNUE"
+#define NNUEMAPPEDLAYOUT 2
+struct NnueMappedHeader {
+    char magic[8];
+    uint32_t layout;
+    uint32_t filehash;
+    uint64_t datasize;
+    char padding[40];
+};
+static_assert(sizeof(NnueMappedHeader) == 64, "Header of mapped net must keep the weights aligned");
+
+#ifdef NNUEINCLUDED
+// Embed the default net in the binary
+#define NNUESTRINGIFY(x) #x
+#define NNUEINCLUDEFILE(x) NNUESTRINGIFY(x)
+__asm__(
+    ".section .rodata\n"
+    ".balign 64\n"
+    ".global NnueEmbeddedData\n"
+    "NnueEmbeddedData:\n"
+    ".incbin \"" NNUEINCLUDEFILE(NNUEINCLUDED) "\"\n"
+    ".global NnueEmbeddedEnd\n"
+    "NnueEmbeddedEnd:\n"
+    ".byte 0\n"
+    ".previous\n"
+);
+extern "C" const char NnueEmbeddedData[];
+extern "C" const char NnueEmbeddedEnd[];
+#endif
+
+
+//
+// NNUE interface in chessposition
+//
+void chessposition::HalfkpAppendChangedIndices(int c, DirtyPiece *dp, NnueIndexList* add, NnueIndexList* remove)
 {
     int k = ORIENT(c, kingpos[c]);
-    DirtyPiece* dp = &dirtypiece[mstop];
     for (int i = 0; i < dp->dirtyNum; i++) {
         PieceCode pc = dp->pc[i];
         if ((pc >> 1) == KING) continue;
@@ -114,22 +167,13 @@ void chessposition::HalfkpAppendChangedIndices(int c, NnueIndexList* add, NnueIn
     }
 }
 
-void chessposition::AppendChangedIndices(NnueIndexList add[2], NnueIndexList remove[2], bool reset[2])
-{
-    DirtyPiece* dp = &dirtypiece[mstop];
-    if (dp->dirtyNum == 0)
-        return;  // FIXME: When will this happen? reset is uninitialized in this case.
+#if defined(USE_AVX512)
+#define SIMD_WIDTH 512
+typedef __m512i vec_t;
+#define vec_add_16(a,b) _mm512_add_epi16(a,b)
+#define vec_sub_16(a,b) _mm512_sub_epi16(a,b)
 
-    for (int c = 0; c < 2; c++) {
-        reset[c] = (dp->pc[0] == (PieceCode)(WKING | c));
-        if (reset[c])
-            HalfkpAppendActiveIndices(c, &add[c]);
-        else
-            HalfkpAppendChangedIndices(c, &add[c], &remove[c]);
-    }
-}
-
-#ifdef USE_AVX2
+#elif defined(USE_AVX2)
 #define SIMD_WIDTH 256
 typedef __m256i vec_t;
 #define vec_add_16(a,b) _mm256_add_epi16(a,b)
@@ -141,188 +185,237 @@ typedef __m128i vec_t;
 #define vec_add_16(a,b) _mm_add_epi16(a,b)
 #define vec_sub_16(a,b) _mm_sub_epi16(a,b)
 
+#elif defined(USE_NEON)
+#define SIMD_WIDTH 128
+typedef int16x8_t vec_t;
+#define vec_add_16(a,b) vaddq_s16(a,b)
+#define vec_sub_16(a,b) vsubq_s16(a,b)
+
 #endif
 
-#if defined(USE_SSE2)
+#if defined(USE_AVX512)
+// 8 registers hold the complete accumulator of one perspective
+#define NUM_REGS 8
+#elif defined(USE_SSE2)
+#define NUM_REGS 16
+#elif defined(USE_NEON) && defined(__aarch64__)
+// AArch64 has 32 vector registers, half of them hold the tile
 #define NUM_REGS 16
+#elif defined(USE_NEON)
+#define NUM_REGS 8
 #endif
 
 
-#if defined(USE_SSE2) || defined(USE_MMX)
+#ifdef SIMD_WIDTH
 #define TILE_HEIGHT (NUM_REGS * SIMD_WIDTH / 16)
 #else
 #define TILE_HEIGHT NnueFtHalfdims
 #endif
 
 
-void chessposition::RefreshAccumulator()
+// Fused kernel for a fixed number of added and removed features as produced by the common moves.
+// It streams in -> out once and applies all columns to each vector while it is in a register.
+template <int NumAdd, int NumRemove>
+static void NnueUpdateHalfFused(int16_t *weight, int16_t *out, int16_t *in, NnueIndexList *add, NnueIndexList *remove)
 {
-    NnueAccumulator *ac = &accumulator[mstop];
-    NnueIndexList activeIndices[2];
-    activeIndices[0].size = activeIndices[1].size = 0;
-    AppendActiveIndices(activeIndices);
-
-    for (int c = 0; c < 2; c++) {
-
-        for (int i = 0; i < NnueFtHalfdims / TILE_HEIGHT; i++) {
-
-#if defined(USE_SSE2) || defined(USE_MMX)
-            vec_t* ft_biases_tile = (vec_t*)&NnueFt->bias[i * TILE_HEIGHT];
-            vec_t* accTile = (vec_t*)&ac->accumulation[c][i * TILE_HEIGHT];
-            vec_t acc[NUM_REGS];
-            for (unsigned j = 0; j < NUM_REGS; j++)
-                acc[j] = ft_biases_tile[j];
+    int16_t* addcol[NumAdd];
+    int16_t* removecol[NumRemove];
+    for (int k = 0; k < NumAdd; k++)
+        addcol[k] = &weight[NnueFtHalfdims * add->values[k]];
+    for (int k = 0; k < NumRemove; k++)
+        removecol[k] = &weight[NnueFtHalfdims * remove->values[k]];
+
+#ifdef SIMD_WIDTH
+    const unsigned numChunks = NnueFtHalfdims * 16 / SIMD_WIDTH;
+    vec_t* inVec = (vec_t*)in;
+    vec_t* outVec = (vec_t*)out;
+    for (unsigned j = 0; j < numChunks; j++) {
+        vec_t acc = inVec[j];
+        for (int k = 0; k < NumRemove; k++)
+            acc = vec_sub_16(acc, ((vec_t*)removecol[k])[j]);
+        for (int k = 0; k < NumAdd; k++)
+            acc = vec_add_16(acc, ((vec_t*)addcol[k])[j]);
+        outVec[j] = acc;
+    }
 
 #else
-
-            memcpy(&(ac->accumulation[c][i * TILE_HEIGHT]), &NnueFt->bias[i * TILE_HEIGHT], TILE_HEIGHT * sizeof(int16_t));
+    for (int j = 0; j < NnueFtHalfdims; j++) {
+        int16_t acc = in[j];
+        for (int k = 0; k < NumRemove; k++)
+            acc -= removecol[k][j];
+        for (int k = 0; k < NumAdd; k++)
+            acc += addcol[k][j];
+        out[j] = acc;
+    }
 #endif
+}
 
-            for (size_t k = 0; k < activeIndices[c].size; k++) {
-                unsigned index = activeIndices[c].values[k];
-                unsigned offset = NnueFtHalfdims * index + i * TILE_HEIGHT;
-
-#if defined(USE_SSE2) || defined(USE_MMX)
-                vec_t* column = (vec_t*)&NnueFt->weight[offset];
-                for (unsigned j = 0; j < NUM_REGS; j++)
-                    acc[j] = vec_add_16(acc[j], column[j]);
+// Apply the removed and added features to an accumulator half; in and out may be the same
+static void NnueUpdateHalf(int16_t *weight, int16_t *out, int16_t *in, NnueIndexList *add, NnueIndexList *remove)
+{
+    // quiet move, capture or promotion, two quiet moves (walk back) or castling with two changes
+    if (add->size == 1 && remove->size == 1)
+        return NnueUpdateHalfFused<1, 1>(weight, out, in, add, remove);
+    if (add->size == 1 && remove->size == 2)
+        return NnueUpdateHalfFused<1, 2>(weight, out, in, add, remove);
+    if (add->size == 2 && remove->size == 2)
+        return NnueUpdateHalfFused<2, 2>(weight, out, in, add, remove);
 
-#elif defined(USE_NEON)
-                int16x8_t* accumulation = (int16x8_t*)&ac->accumulation[c][i * TILE_HEIGHT];
-                int16x8_t* column = (int16x8_t*)&NnueFt->weight[offset];
-                const unsigned numChunks = NnueFtHalfdims / 8;
-                for (unsigned j = 0; j < numChunks; j++)
-                    accumulation[j] = vaddq_s16(accumulation[j], column[j]);
+    for (int i = 0; i < NnueFtHalfdims / TILE_HEIGHT; i++) {
+#ifdef SIMD_WIDTH
+        vec_t* inTile = (vec_t*)&in[i * TILE_HEIGHT];
+        vec_t* outTile = (vec_t*)&out[i * TILE_HEIGHT];
+        vec_t acc[NUM_REGS];
+        for (unsigned j = 0; j < NUM_REGS; j++)
+            acc[j] = inTile[j];
 
 #else
-
-                for (unsigned j = 0; j < NnueFtHalfdims; j++)
-                    ac->accumulation[c][i * TILE_HEIGHT + j] += NnueFt->weight[offset + j];
+        if (out != in)
+            memcpy(&out[i * TILE_HEIGHT], &in[i * TILE_HEIGHT], TILE_HEIGHT * sizeof(int16_t));
 #endif
-            }
+        // Difference calculation for the deactivated features
+        for (size_t k = 0; k < remove->size; k++) {
+            unsigned index = remove->values[k];
+            const unsigned offset = NnueFtHalfdims * index + i * TILE_HEIGHT;
+#ifdef SIMD_WIDTH
+            vec_t* column = (vec_t*)&weight[offset];
+            for (unsigned j = 0; j < NUM_REGS; j++)
+                acc[j] = vec_sub_16(acc[j], column[j]);
 
-#if defined(USE_SSE2) || defined(USE_MMX)
+#else
+            for (int j = 0; j < TILE_HEIGHT; j++)
+                out[i * TILE_HEIGHT + j] -= weight[offset + j];
+#endif
+        }
+        // Difference calculation for the activated features
+        for (size_t k = 0; k < add->size; k++) {
+            unsigned index = add->values[k];
+            const unsigned offset = NnueFtHalfdims * index + i * TILE_HEIGHT;
+#ifdef SIMD_WIDTH
+            vec_t* column = (vec_t*)&weight[offset];
             for (unsigned j = 0; j < NUM_REGS; j++)
-                accTile[j] = acc[j];
+                acc[j] = vec_add_16(acc[j], column[j]);
 
+#else
+            for (int j = 0; j < TILE_HEIGHT; j++)
+                out[i * TILE_HEIGHT + j] += weight[offset + j];
 #endif
         }
-    }
 
-    ac->computationState = 1;
+#ifdef SIMD_WIDTH
+        for (unsigned j = 0; j < NUM_REGS; j++)
+            outTile[j] = acc[j];
+
+#endif
+    }
 }
 
-// Test if we can update the accumulator from the previous position
-bool chessposition::UpdateAccumulator()
+// Compute the accumulator half of perspective c from the cached one of the same king square
+void chessposition::RefreshFromCache(int slot, int c, int16_t *accumulation)
 {
-    NnueAccumulator *ac = &accumulator[mstop];
-    if (ac->computationState)
-        return true;
-
-    if (mstop == 0)
-        return false;
-
-    NnueAccumulator* prevac = &accumulator[mstop - 1];
-    if (!prevac->computationState)
-        return false;
-
-    NnueIndexList removedIndices[2], addedIndices[2];
-    removedIndices[0].size = removedIndices[1].size = 0;
-    addedIndices[0].size = addedIndices[1].size = 0;
-
-    bool reset[2];
-    AppendChangedIndices(addedIndices, removedIndices, reset);
-
-    for (int i = 0; i < NnueFtHalfdims / TILE_HEIGHT; i++) {
-        for (int c = 0; c < 2; c++) {
-#if defined(USE_SSE2) || defined(USE_MMX)
-            vec_t* accTile = (vec_t*)&ac->accumulation[c][i * TILE_HEIGHT];
-            vec_t acc[NUM_REGS];
-
-#elif defined(USE_NEON)
-            const unsigned numChunks = NnueFtHalfdims / 8;
-            int16x8_t* accTile = (int16x8_t*)&ac->accumulation[c][i * TILE_HEIGHT];
+    NnueFeatureTransformer *nft = NnueCurrentNet(slot)->Ft;
+    NnueFinnyTable *ft = &finnytable[slot];
+    if (ft->netgeneration != NnueNetGeneration[slot])
+    {
+        // cache was filled with weights of another net
+        for (int i = 0; i < 2; i++)
+            for (int j = 0; j < 64; j++)
+                ft->entry[i][j].valid = false;
+        ft->netgeneration = NnueNetGeneration[slot];
+    }
 
-#endif
+    NnueFinnyEntry *fe = &ft->entry[c][kingpos[c]];
+    if (!fe->valid)
+    {
+        memcpy(fe->accumulation, nft->bias, sizeof(fe->accumulation));
+        memset(fe->piece00, 0, sizeof(fe->piece00));
+        fe->valid = true;
+    }
 
-            if (reset[c]) {
-#if defined(USE_SSE2) || defined(USE_MMX)
-                vec_t* ft_b_tile = (vec_t*)&NnueFt->bias[i * TILE_HEIGHT];
-                for (unsigned j = 0; j < NUM_REGS; j++)
-                    acc[j] = ft_b_tile[j];
-#else
+    NnueIndexList add, remove;
+    add.size = remove.size = 0;
+    int k = ORIENT(c, kingpos[c]);
+    for (int pc = WPAWN; pc <= BQUEEN; pc++)
+    {
+        U64 removed = fe->piece00[pc] & ~piece00[pc];
+        U64 added = piece00[pc] & ~fe->piece00[pc];
+        while (removed)
+            remove.values[remove.size++] = MAKEINDEX(c, pullLsb(&removed), pc, k);
+        while (added)
+            add.values[add.size++] = MAKEINDEX(c, pullLsb(&added), pc, k);
+        fe->piece00[pc] = piece00[pc];
+    }
 
-                memcpy(&ac->accumulation[c][i * TILE_HEIGHT], &NnueFt->bias[i * TILE_HEIGHT], TILE_HEIGHT * sizeof(int16_t));
-#endif
-            }
-            else {
-#if defined(USE_SSE2) || defined(USE_MMX)
-                vec_t* prevAccTile = (vec_t*)&prevac->accumulation[c][i * TILE_HEIGHT];
-                for (unsigned j = 0; j < NUM_REGS; j++)
-                    acc[j] = prevAccTile[j];
-#else
-                memcpy(&ac->accumulation[c][i * TILE_HEIGHT], &prevac->accumulation[c][i * TILE_HEIGHT], TILE_HEIGHT * sizeof(int16_t));
-#endif
-                // Difference calculation for the deactivated features
-                for (size_t k = 0; k < removedIndices[c].size; k++) {
-                    int index = removedIndices[c].values[k];
-                    const int offset = NnueFtHalfdims * index + i * TILE_HEIGHT;
-#if defined(USE_SSE2) || defined(USE_MMX)
-                    vec_t* column = (vec_t*)&NnueFt->weight[offset];
-                    for (unsigned j = 0; j < NUM_REGS; j++)
-                        acc[j] = vec_sub_16(acc[j], column[j]);
+    NnueUpdateHalf(nft->weight, fe->accumulation, fe->accumulation, &add, &remove);
+    memcpy(accumulation, fe->accumulation, sizeof(fe->accumulation));
+}
 
-#elif defined(USE_NEON)
-                    int16x8_t* column = (int16x8_t*)&NnueFt->weight[offset];
-                    for (unsigned j = 0; j < numChunks; j++)
-                        accTile[j] = vsubq_s16(accTile[j], column[j]);
+void chessposition::RefreshAccumulator(int slot)
+{
+    NnueAccumulator *ac = &accumulator[mstop];
+    for (int c = 0; c < 2; c++)
+        RefreshFromCache(slot, c, ac->accumulation[slot][c]);
 
-#else
-                    for (int j = 0; j < NnueFtHalfdims; j++)
-                        ac->accumulation[c][i * TILE_HEIGHT + j] -= NnueFt->weight[offset + j];
-#endif
-                }
-            }
-            // Difference calculation for the activated features
-            for (size_t k = 0; k < addedIndices[c].size; k++) {
-                int index = addedIndices[c].values[k];
-                const int offset = NnueFtHalfdims * index + i * TILE_HEIGHT;
-#if defined(USE_SSE2) || defined(USE_MMX)
-                vec_t* column = (vec_t*)&NnueFt->weight[offset];
-                for (unsigned j = 0; j < NUM_REGS; j++)
-                    acc[j] = vec_add_16(acc[j], column[j]);
+    ac->computationState |= (1 << slot);
+}
 
-#elif defined(USE_NEON)
-                int16x8_t* column = (int16x8_t*)&NnueFt->weight[offset];
-                for (unsigned j = 0; j < numChunks; j++)
-                    accTile[j] = vaddq_s16(accTile[j], column[j]);
+// Maximum number of plies to walk back for an update; each ply changes up to 3 features and the index lists hold 30
+#define NNUEMAXWALKBACK 10
 
-#else
-                for (int j = 0; j < TILE_HEIGHT; j++)
-                    ac->accumulation[c][i * TILE_HEIGHT + j] += NnueFt->weight[offset + j];
-#endif
-            }
+// Test if we can update the accumulator from the nearest computed ancestor applying the changes of all plies in between
+bool chessposition::UpdateAccumulator(int slot)
+{
+    const int computed = (1 << slot);
+    NnueAccumulator *ac = &accumulator[mstop];
+    if (ac->computationState & computed)
+        return true;
 
-#if defined(USE_SSE2) || defined(USE_MMX)
-            for (unsigned j = 0; j < NUM_REGS; j++)
-                accTile[j] = acc[j];
+    // Walk back to the last computed accumulator; a king move needs a refresh of this perspective
+    bool reset[2] = { false, false };
+    int ancestor = mstop;
+    while (!(accumulator[ancestor].computationState & computed))
+    {
+        if (ancestor == 0 || mstop - ancestor >= NNUEMAXWALKBACK)
+            return false;
+        DirtyPiece* dp = &dirtypiece[ancestor];
+        for (int c = 0; c < 2; c++)
+            reset[c] = reset[c] || (dp->dirtyNum && dp->pc[0] == (PieceCode)(WKING | c));
+        ancestor--;
+    }
 
-#endif
+    NnueAccumulator* prevac = &accumulator[ancestor];
+    int16_t* weight = NnueCurrentNet(slot)->Ft->weight;
+    for (int c = 0; c < 2; c++) {
+        if (reset[c]) {
+            RefreshFromCache(slot, c, ac->accumulation[slot][c]);
+            continue;
         }
+        NnueIndexList removedIndices, addedIndices;
+        removedIndices.size = addedIndices.size = 0;
+        for (int i = ancestor + 1; i <= mstop; i++)
+            HalfkpAppendChangedIndices(c, &dirtypiece[i], &addedIndices, &removedIndices);
+        // all changes in a single pass over the accumulator
+        NnueUpdateHalf(weight, ac->accumulation[slot][c], prevac->accumulation[slot][c], &addedIndices, &removedIndices);
     }
 
-    ac->computationState = 1;
+    ac->computationState |= computed;
     return true;
 }
 
-void chessposition::Transform(clipped_t *output)
+void chessposition::Transform(int slot, clipped_t *output)
 {
-    if (!UpdateAccumulator())
-        RefreshAccumulator();
+    if (!UpdateAccumulator(slot))
+        RefreshAccumulator(slot);
 
-    int16_t(*acc)[2][256] = &accumulator[mstop].accumulation;
+    int16_t(*acc)[2][256] = &accumulator[mstop].accumulation[slot];
 
-#if defined(USE_AVX2)
+#if defined(USE_AVX512)
+    const unsigned numChunks = NnueFtHalfdims / 64;
+    const __m512i kZero = _mm512_setzero_si512();
+    // packs works on 128bit lanes; this restores the order of the bytes
+    const __m512i kOrder = _mm512_set_epi64(7, 5, 3, 1, 6, 4, 2, 0);
+
+#elif defined(USE_AVX2)
     const unsigned numChunks = NnueFtHalfdims / 32;
     const __m256i kZero = _mm256_setzero_si256();
 
@@ -330,9 +423,14 @@ void chessposition::Transform(clipped_t *output)
     const unsigned numChunks = NnueFtHalfdims / 16;
     const __m128i k0x80s = _mm_set1_epi8(-128);
 
-#elif defined(USE_NEON)
+#elif defined(USE_SSE2)
     const unsigned numChunks = NnueFtHalfdims / 8;
-    const int8x8_t kZero = { 0 };
+    const __m128i kZero = _mm_setzero_si128();
+    const __m128i k127 = _mm_set1_epi16(127);
+
+#elif defined(USE_NEON)
+    const unsigned numChunks = NnueFtHalfdims / 16;
+    const int8x16_t kZero = vdupq_n_s8(0);
 
 #endif
 
@@ -341,7 +439,16 @@ void chessposition::Transform(clipped_t *output)
     {
         const unsigned int offset = NnueFtHalfdims * p;
 
-#if defined(USE_AVX2)
+#if defined(USE_AVX512)
+        __m512i* out = (__m512i*) & output[offset];
+        for (unsigned i = 0; i < numChunks; i++) {
+            __m512i sum0 = ((__m512i*)(*acc)[perspectives[p]])[i * 2 + 0];
+            __m512i sum1 = ((__m512i*)(*acc)[perspectives[p]])[i * 2 + 1];
+            out[i] = _mm512_maskz_permutexvar_epi64(0xff, kOrder, _mm512_max_epi8(
+                _mm512_packs_epi16(sum0, sum1), kZero));
+        }
+
+#elif defined(USE_AVX2)
         __m256i* out = (__m256i*) & output[offset];
         for (unsigned i = 0; i < numChunks; i++) {
             __m256i sum0 = ((__m256i*)(*acc)[perspectives[p]])[i * 2 + 0];
@@ -359,11 +466,19 @@ void chessposition::Transform(clipped_t *output)
             out[i] = _mm_subs_epi8(_mm_adds_epi8(packedbytes, k0x80s), k0x80s);
         }
 
+#elif defined(USE_SSE2)
+        __m128i* out = (__m128i*) & output[offset];
+        for (unsigned i = 0; i < numChunks; i++) {
+            __m128i sum = ((__m128i*)(*acc)[perspectives[p]])[i];
+            out[i] = _mm_min_epi16(_mm_max_epi16(sum, kZero), k127);
+        }
+
 #elif defined(USE_NEON)
-        int8x8_t* out = (int8x8_t*)&output[offset];
+        int8x16_t* out = (int8x16_t*)&output[offset];
         for (unsigned i = 0; i < numChunks; i++) {
-            int16x8_t sum = ((int16x8_t*)(*acc)[perspectives[p]])[i];
-            out[i] = vmax_s8(vqmovn_s16(sum), kZero);
+            int16x8_t sum0 = ((int16x8_t*)(*acc)[perspectives[p]])[i * 2 + 0];
+            int16x8_t sum1 = ((int16x8_t*)(*acc)[perspectives[p]])[i * 2 + 1];
+            out[i] = vmaxq_s8(vcombine_s8(vqmovn_s16(sum0), vqmovn_s16(sum1)), kZero);
         }
 
 #else
@@ -386,16 +501,71 @@ struct NnueNetwork {
     int32_t out_value;
 };
 
+// Values of the hidden layers for the batch evaluation
+struct NnueBatchValues {
+    alignas(64) int32_t hidden1_values[32];
+    int32_t hidden2_values[32];
+    clipped_t hidden1_clipped[32];
+    clipped_t hidden2_clipped[32];
+    int32_t out_value;
+};
+
+// Number of positions that pass a layer together while its weights are in cache
+#define NNUEBATCHBLOCK 16
+
+// Evaluate n positions given by their transformed accumulators (n * NnueFtOutputdims values, 64 byte aligned).
+// The positions go through the network layer by layer in blocks, so the weights of each layer are reused from cache.
+void NnueEvalBatch(int slot, clipped_t *input, int n, int *scores)
+{
+    NnueBatchValues values[NNUEBATCHBLOCK];
+    NnueNet* net = NnueCurrentNet(slot);
+
+    for (int b = 0; b < n; b += NNUEBATCHBLOCK)
+    {
+        int num = min(NNUEBATCHBLOCK, n - b);
+        clipped_t *in = input + (size_t)b * NnueFtOutputdims;
+        for (int i = 0; i < num; i++)
+            net->Hd1->Propagate(in + (size_t)i * NnueFtOutputdims, values[i].hidden1_values);
+        for (int i = 0; i < num; i++)
+            net->Cl1->Propagate(values[i].hidden1_values, values[i].hidden1_clipped);
+        for (int i = 0; i < num; i++)
+            net->Hd2->Propagate(values[i].hidden1_clipped, values[i].hidden2_values);
+        for (int i = 0; i < num; i++)
+            net->Cl2->Propagate(values[i].hidden2_values, values[i].hidden2_clipped);
+        for (int i = 0; i < num; i++) {
+            net->Out->Propagate(values[i].hidden2_clipped, &values[i].out_value);
+            scores[b + i] = values[i].out_value / NnueValueScale;
+        }
+    }
+}
+
+// The endgame net (if loaded) evaluates positions with up to NnueEndgamePieces pieces (including kings and pawns)
+int chessposition::NnueSelectNet()
+{
+#ifdef NNUEENDGAME
+    if (NnueEndgameReady && POPCOUNT(occupied00[0] | occupied00[1]) <= en.NnueEndgamePieces)
+        return NNUEENDGAMENET;
+#endif
+    return NNUEMAINNET;
+}
+
 int chessposition::NnueGetEval()
 {
     NnueNetwork network;
+    int slot = NnueSelectNet();
+    NnueNet* net = NnueCurrentNet(slot);
 
-    Transform(network.input);
-    NnueHd1->Propagate(network.input, network.hidden1_values);
-    NnueCl1->Propagate(network.hidden1_values, network.hidden1_clipped);
-    NnueHd2->Propagate(network.hidden1_clipped, network.hidden2_values);
-    NnueCl1->Propagate(network.hidden2_values, network.hidden2_clipped);
-    NnueOut->Propagate(network.hidden2_clipped, &network.out_value);
+#ifdef NNUEBENCH
+    if (NnueBenchRecording && !threadindex)
+        NnueBenchRecord(slot);
+#endif
+
+    Transform(slot, network.input);
+    net->Hd1->Propagate(network.input, network.hidden1_values);
+    net->Cl1->Propagate(network.hidden1_values, network.hidden1_clipped);
+    net->Hd2->Propagate(network.hidden1_clipped, network.hidden2_values);
+    net->Cl1->Propagate(network.hidden2_values, network.hidden2_clipped);
+    net->Out->Propagate(network.hidden2_clipped, &network.out_value);
 
     return network.out_value / NnueValueScale;
 }
@@ -406,29 +576,24 @@ int chessposition::NnueGetEval()
 //
 NnueFeatureTransformer::NnueFeatureTransformer() : NnueLayer(NULL)
 {
-    size_t allocsize = NnueFtHalfdims * sizeof(int16_t);
-    bias = (int16_t*)allocalign64(allocsize);
-    allocsize = (size_t)NnueFtHalfdims * (size_t)NnueFtInputdims * sizeof(int16_t);
-    weight = (int16_t*)allocalign64(allocsize);
+    bias = nullptr;
+    weight = nullptr;
 }
 
-NnueFeatureTransformer::~NnueFeatureTransformer()
+size_t NnueFeatureTransformer::AssignWeights(char *base, size_t offset)
 {
-    freealigned64(bias);
-    freealigned64(weight);
+    bias = (int16_t*)(base ? base + offset : nullptr);
+    offset = NNUEALIGN64(offset + NnueFtHalfdims * sizeof(int16_t));
+    weight = (int16_t*)(base ? base + offset : nullptr);
+    return NNUEALIGN64(offset + (size_t)NnueFtHalfdims * (size_t)NnueFtInputdims * sizeof(int16_t));
 }
 
-bool NnueFeatureTransformer::ReadWeights(ifstream *is)
+bool NnueFeatureTransformer::ReadWeights(istream *is)
 {
-    int i;
-    for (i = 0; i < NnueFtHalfdims; ++i)
-        is->read((char*)&bias[i], sizeof(int16_t));
-    for (i = 0; i < NnueFtHalfdims * NnueFtInputdims; ++i)
-        is->read((char*)&weight[i], sizeof(int16_t));
+    is->read((char*)bias, NnueFtHalfdims * sizeof(int16_t));
+    is->read((char*)weight, (size_t)NnueFtHalfdims * (size_t)NnueFtInputdims * sizeof(int16_t));
 
     return !is->fail();
-
-    return true;
 }
 
 uint32_t NnueFeatureTransformer::GetHash()
@@ -440,36 +605,47 @@ uint32_t NnueFeatureTransformer::GetHash()
 //
 // NetworkLayer
 //
-NnueNetworkLayer::NnueNetworkLayer(NnueLayer* prev, int id, int od) : NnueLayer(prev)
+NnueNetworkLayer::NnueNetworkLayer(NnueLayer* prev, int id, int od, bool sp) : NnueLayer(prev)
 {
     inputdims = id;
     outputdims = od;
-    size_t allocsize = od * sizeof(int32_t);
-    bias = (int32_t*)allocalign64(allocsize);
-    allocsize = (size_t)id * (size_t)od * sizeof(int8_t);
-    weight = (int8_t*)allocalign64(allocsize);
+    sparse = sp;
+    bias = nullptr;
+    weight = nullptr;
+    sparseweight = nullptr;
 }
 
-NnueNetworkLayer::~NnueNetworkLayer()
+size_t NnueNetworkLayer::AssignWeights(char *base, size_t offset)
 {
-    freealigned64(bias);
-    freealigned64(weight);
+    bias = (int32_t*)(base ? base + offset : nullptr);
+    offset = NNUEALIGN64(offset + outputdims * sizeof(int32_t));
+    weight = (int8_t*)(base ? base + offset : nullptr);
+    offset = NNUEALIGN64(offset + (size_t)inputdims * (size_t)outputdims * sizeof(int8_t));
+    if (!sparse)
+        return offset;
+    sparseweight = (int8_t*)(base ? base + offset : nullptr);
+    return NNUEALIGN64(offset + (size_t)inputdims * (size_t)outputdims * sizeof(int8_t));
 }
 
-bool NnueNetworkLayer::ReadWeights(ifstream* is)
+// Build the transposed weights after the layer was read from a standard net file
+void NnueNetworkLayer::TransposeWeights()
 {
-    int i;
+    if (!sparse)
+        return;
+    for (int k = 0; k < inputdims / 4; k++)
+        for (int o = 0; o < outputdims; o++)
+            for (int b = 0; b < 4; b++)
+                sparseweight[(k * outputdims + o) * 4 + b] = weight[o * inputdims + k * 4 + b];
+}
 
-    if (previous)
-        previous->ReadWeights(is);
-    for (i = 0; i < outputdims; ++i)
-        is->read((char*)&bias[i], sizeof(int32_t));
-    for (i = 0; i < outputdims * inputdims; ++i)
-        is->read((char*)&weight[i], sizeof(int8_t));
+bool NnueNetworkLayer::ReadWeights(istream* is)
+{
+    if (previous && !previous->ReadWeights(is))
+        return false;
+    is->read((char*)bias, outputdims * sizeof(int32_t));
+    is->read((char*)weight, (size_t)outputdims * (size_t)inputdims * sizeof(int8_t));
 
     return !is->fail();
-
-    return true;
 }
 
 uint32_t NnueNetworkLayer::GetHash()
@@ -479,19 +655,31 @@ uint32_t NnueNetworkLayer::GetHash()
 
 void NnueNetworkLayer::Propagate(clipped_t* input, int32_t* output)
 {
+#ifdef NNUESPARSEPROPAGATE
+    if (sparse)
+        return PropagateSparse(input, output);
+#endif
+
 #if defined(USE_AVX2)
 const unsigned numChunks = inputdims / 32;
 __m256i* inVec = (__m256i*)input;
+#if !defined(USE_VNNI)
 const __m256i kOnes = _mm256_set1_epi16(1);
+#endif
 
 #elif defined(USE_SSSE3)
 const unsigned numChunks = inputdims / 16;
 const __m128i kOnes = _mm_set1_epi16(1);
 __m128i* inVec = (__m128i*)input;
 
+#elif defined(USE_SSE2)
+    // 16bit inputs; the weights are sign extended to 16bit and multiplied with madd
+    const unsigned numChunks = inputdims / 16;
+    __m128i* inVec = (__m128i*)input;
+
 #elif defined(USE_NEON)
     const unsigned numChunks = inputdims / 16;
-    int8x8_t* inVec = (int8x8_t*)input;
+    int8x16_t* inVec = (int8x16_t*)input;
 
 #endif
 
@@ -504,9 +692,13 @@ __m128i* inVec = (__m128i*)input;
         __m256i* row = (__m256i*) &weight[offset];
 
         for (unsigned j = 0; j < numChunks; j++) {
+#if defined(USE_VNNI)
+            sum = _mm256_dpbusd_epi32(sum, inVec[j], row[j]);
+#else
             __m256i product = _mm256_maddubs_epi16(inVec[j], row[j]);
             product = _mm256_madd_epi16(product, kOnes);
             sum = _mm256_add_epi32(sum, product);
+#endif
         }
 
         __m128i sum128 = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
@@ -529,15 +721,37 @@ __m128i* inVec = (__m128i*)input;
         sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1)); //_MM_PERM_CDAB
         output[i] = _mm_cvtsi128_si32(sum) + bias[i];
 
+#elif defined(USE_SSE2)
+        __m128i sum = _mm_setzero_si128();
+        __m128i* row = (__m128i*)&weight[offset];
+        for (unsigned j = 0; j < numChunks; j++) {
+            __m128i w = row[j];
+            __m128i wlo = _mm_srai_epi16(_mm_unpacklo_epi8(w, w), 8);
+            __m128i whi = _mm_srai_epi16(_mm_unpackhi_epi8(w, w), 8);
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(inVec[j * 2], wlo));
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(inVec[j * 2 + 1], whi));
+        }
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E)); //_MM_PERM_BADC
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1)); //_MM_PERM_CDAB
+        output[i] = _mm_cvtsi128_si32(sum) + bias[i];
+
 #elif defined(USE_NEON)
-        int32x4_t sum = { bias[i] };
-        int8x8_t* row = (int8x8_t*)&weight[offset];
+        int32x4_t sum = vdupq_n_s32(0);
+        int8x16_t* row = (int8x16_t*)&weight[offset];
         for (unsigned j = 0; j < numChunks; j++) {
-            int16x8_t product = vmull_s8(inVec[j * 2], row[j * 2]);
-            product = vmlal_s8(product, inVec[j * 2 + 1], row[j * 2 + 1]);
+#if defined(USE_DOTPROD)
+            sum = vdotq_s32(sum, inVec[j], row[j]);
+#else
+            int16x8_t product = vmull_s8(vget_low_s8(inVec[j]), vget_low_s8(row[j]));
+            product = vmlal_s8(product, vget_high_s8(inVec[j]), vget_high_s8(row[j]));
             sum = vpadalq_s16(sum, product);
-    }
-        output[i] = sum[0] + sum[1] + sum[2] + sum[3];
+#endif
+        }
+#if defined(__aarch64__)
+        output[i] = vaddvq_s32(sum) + bias[i];
+#else
+        output[i] = vgetq_lane_s32(sum, 0) + vgetq_lane_s32(sum, 1) + vgetq_lane_s32(sum, 2) + vgetq_lane_s32(sum, 3) + bias[i];
+#endif
 
 #else
         int32_t sum = bias[i];
@@ -549,6 +763,136 @@ __m128i* inVec = (__m128i*)input;
     }
 }
 
+// Affine transformation that only uses the non-zero chunks of 4 input bytes.
+// Most outputs of the feature transformer are clipped to zero so this saves a lot of the work in the first hidden layer.
+void NnueNetworkLayer::PropagateSparse(clipped_t* input, int32_t* output)
+{
+#ifdef NNUESPARSEPROPAGATE
+    const int numChunks = inputdims / 4;
+    uint32_t* in32 = (uint32_t*)input;
+    uint16_t nnz[NnueFtOutputdims / 4];
+    int nnzcount = 0;
+
+    // Collect the non-zero input chunks
+#if defined(USE_AVX2)
+    const __m256i kZero = _mm256_setzero_si256();
+    for (int i = 0; i < numChunks; i += 8) {
+        __m256i in = _mm256_load_si256((__m256i*)&in32[i]);
+        U64 mask = ~_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(in, kZero))) & 0xff;
+        while (mask)
+            nnz[nnzcount++] = i + pullLsb(&mask);
+    }
+#elif defined(USE_SSSE3)
+    const __m128i kZero = _mm_setzero_si128();
+    for (int i = 0; i < numChunks; i += 4) {
+        __m128i in = _mm_load_si128((__m128i*)&in32[i]);
+        U64 mask = ~_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(in, kZero))) & 0xf;
+        while (mask)
+            nnz[nnzcount++] = i + pullLsb(&mask);
+    }
+#else
+    for (int i = 0; i < numChunks; i++)
+        if (in32[i])
+            nnz[nnzcount++] = i;
+#endif
+
+    // Accumulate the weight columns of the non-zero chunks
+#if defined(USE_AVX512)
+    const int numRegs = NNUESPARSEMAXOUTPUTS / 16;
+    __m512i acc[numRegs];
+    for (int r = 0; r < outputdims / 16; r++)
+        acc[r] = _mm512_load_si512((__m512i*)&bias[r * 16]);
+#if !defined(USE_VNNI)
+    const __m512i kOnes = _mm512_set1_epi16(1);
+#endif
+    for (int j = 0; j < nnzcount; j++) {
+        const __m512i in = _mm512_set1_epi32(in32[nnz[j]]);
+        const __m512i* col = (__m512i*)&sparseweight[nnz[j] * outputdims * 4];
+        for (int r = 0; r < outputdims / 16; r++) {
+#if defined(USE_VNNI)
+            acc[r] = _mm512_dpbusd_epi32(acc[r], in, col[r]);
+#else
+            acc[r] = _mm512_add_epi32(acc[r], _mm512_madd_epi16(_mm512_maddubs_epi16(in, col[r]), kOnes));
+#endif
+        }
+    }
+    for (int r = 0; r < outputdims / 16; r++)
+        _mm512_store_si512((__m512i*)&output[r * 16], acc[r]);
+
+#elif defined(USE_AVX2)
+    const int numRegs = NNUESPARSEMAXOUTPUTS / 8;
+    __m256i acc[numRegs];
+    for (int r = 0; r < outputdims / 8; r++)
+        acc[r] = _mm256_load_si256((__m256i*)&bias[r * 8]);
+#if !defined(USE_VNNI)
+    const __m256i kOnes = _mm256_set1_epi16(1);
+#endif
+    for (int j = 0; j < nnzcount; j++) {
+        const __m256i in = _mm256_set1_epi32(in32[nnz[j]]);
+        const __m256i* col = (__m256i*)&sparseweight[nnz[j] * outputdims * 4];
+        for (int r = 0; r < outputdims / 8; r++) {
+#if defined(USE_VNNI)
+            acc[r] = _mm256_dpbusd_epi32(acc[r], in, col[r]);
+#else
+            acc[r] = _mm256_add_epi32(acc[r], _mm256_madd_epi16(_mm256_maddubs_epi16(in, col[r]), kOnes));
+#endif
+        }
+    }
+    for (int r = 0; r < outputdims / 8; r++)
+        _mm256_store_si256((__m256i*)&output[r * 8], acc[r]);
+
+#elif defined(USE_SSSE3)
+    const int numRegs = NNUESPARSEMAXOUTPUTS / 4;
+    __m128i acc[numRegs];
+    for (int r = 0; r < outputdims / 4; r++)
+        acc[r] = _mm_load_si128((__m128i*)&bias[r * 4]);
+    const __m128i kOnes = _mm_set1_epi16(1);
+    for (int j = 0; j < nnzcount; j++) {
+        const __m128i in = _mm_set1_epi32(in32[nnz[j]]);
+        const __m128i* col = (__m128i*)&sparseweight[nnz[j] * outputdims * 4];
+        for (int r = 0; r < outputdims / 4; r++)
+            acc[r] = _mm_add_epi32(acc[r], _mm_madd_epi16(_mm_maddubs_epi16(in, col[r]), kOnes));
+    }
+    for (int r = 0; r < outputdims / 4; r++)
+        _mm_store_si128((__m128i*)&output[r * 4], acc[r]);
+
+#elif defined(USE_NEON) && defined(USE_DOTPROD)
+    const int numRegs = NNUESPARSEMAXOUTPUTS / 4;
+    int32x4_t acc[numRegs];
+    for (int r = 0; r < outputdims / 4; r++)
+        acc[r] = vld1q_s32(&bias[r * 4]);
+    for (int j = 0; j < nnzcount; j++) {
+        const int8x16_t in = vreinterpretq_s8_u32(vdupq_n_u32(in32[nnz[j]]));
+        const int8x16_t* col = (int8x16_t*)&sparseweight[nnz[j] * outputdims * 4];
+        for (int r = 0; r < outputdims / 4; r++)
+            acc[r] = vdotq_s32(acc[r], col[r], in);
+    }
+    for (int r = 0; r < outputdims / 4; r++)
+        vst1q_s32(&output[r * 4], acc[r]);
+
+#elif defined(USE_NEON)
+    // every register holds two partial sums for two outputs
+    const int numRegs = NNUESPARSEMAXOUTPUTS / 2;
+    int32x4_t acc[numRegs];
+    for (int r = 0; r < outputdims / 2; r++)
+        acc[r] = vdupq_n_s32(0);
+    for (int j = 0; j < nnzcount; j++) {
+        const int8x8_t in = vreinterpret_s8_u32(vdup_n_u32(in32[nnz[j]]));
+        const int8x8_t* col = (int8x8_t*)&sparseweight[nnz[j] * outputdims * 4];
+        for (int r = 0; r < outputdims / 2; r++)
+            acc[r] = vpadalq_s16(acc[r], vmull_s8(in, col[r]));
+    }
+    for (int r = 0; r < outputdims / 2; r++) {
+        output[r * 2] = bias[r * 2] + vgetq_lane_s32(acc[r], 0) + vgetq_lane_s32(acc[r], 1);
+        output[r * 2 + 1] = bias[r * 2 + 1] + vgetq_lane_s32(acc[r], 2) + vgetq_lane_s32(acc[r], 3);
+    }
+#endif
+#else
+    (void)input;
+    (void)output;
+#endif
+}
+
 //
 // ClippedRelu
 //
@@ -557,7 +901,7 @@ NnueClippedRelu::NnueClippedRelu(NnueLayer* prev, int d) : NnueLayer(prev)
     dims = d;
 }
 
-bool NnueClippedRelu::ReadWeights(ifstream* is)
+bool NnueClippedRelu::ReadWeights(istream* is)
 {
     if (previous) return previous->ReadWeights(is);
     return true;
@@ -599,17 +943,28 @@ void NnueClippedRelu::Propagate(int32_t *input, clipped_t *output)
         out[i] = _mm_subs_epi8(_mm_adds_epi8(packedbytes, k0x80s), k0x80s);
     }
 
-#elif defined(USE_NEON)
+#elif defined(USE_SSE2)
     const unsigned numChunks = dims / 8;
-    const int8x8_t kZero = { 0 };
+    const __m128i kZero = _mm_setzero_si128();
+    const __m128i k127 = _mm_set1_epi16(127);
+    __m128i* in = (__m128i*)input;
+    __m128i* out = (__m128i*)output;
+    for (unsigned i = 0; i < numChunks; i++) {
+        __m128i words = _mm_srai_epi16(_mm_packs_epi32(in[i * 2 + 0], in[i * 2 + 1]), NnueClippingShift);
+        out[i] = _mm_min_epi16(_mm_max_epi16(words, kZero), k127);
+    }
+
+#elif defined(USE_NEON)
+    const unsigned numChunks = dims / 16;
+    const int8x16_t kZero = vdupq_n_s8(0);
     int32x4_t* in = (int32x4_t*)input;
-    int8x8_t* out = (int8x8_t*)output;
+    int8x16_t* out = (int8x16_t*)output;
     for (unsigned i = 0; i < numChunks; i++) {
-        int16x8_t shifted;
-        int16x4_t* pack = (int16x4_t*)&shifted;
-        pack[0] = vqshrn_n_s32(in[i * 2 + 0], NnueClippingShift);
-        pack[1] = vqshrn_n_s32(in[i * 2 + 1], NnueClippingShift);
-        out[i] = vmax_s8(vqmovn_s16(shifted), kZero);
+        int16x8_t words0 = vcombine_s16(
+            vqshrn_n_s32(in[i * 4 + 0], NnueClippingShift), vqshrn_n_s32(in[i * 4 + 1], NnueClippingShift));
+        int16x8_t words1 = vcombine_s16(
+            vqshrn_n_s32(in[i * 4 + 2], NnueClippingShift), vqshrn_n_s32(in[i * 4 + 3], NnueClippingShift));
+        out[i] = vmaxq_s8(vcombine_s8(vqmovn_s16(words0), vqmovn_s16(words1)), kZero);
     }
 
 #else
@@ -627,7 +982,7 @@ NnueInputSlice::NnueInputSlice() : NnueLayer(NULL)
 {
 }
 
-bool NnueInputSlice::ReadWeights(ifstream* is)
+bool NnueInputSlice::ReadWeights(istream* is)
 {
     if (previous) return previous->ReadWeights(is);
     return true;
@@ -642,66 +997,812 @@ uint32_t NnueInputSlice::GetHash()
 //
 // Global Interface
 //
+NnueNet::NnueNet()
+{
+    Ft = new NnueFeatureTransformer();
+    In = new NnueInputSlice();
+    Hd1 = new NnueNetworkLayer(In, 512, 32, true);
+    Cl1 = new NnueClippedRelu(Hd1, 32);
+    Hd2 = new NnueNetworkLayer(Cl1, 32, 32);
+    Cl2 = new NnueClippedRelu(Hd2, 32);
+    Out = new NnueNetworkLayer(Cl2, 32, 1);
+    weights = weightsAlloc = nullptr;
+    mapping = nullptr;
+    mappingSize = 0;
+}
+
+NnueNet::~NnueNet()
+{
+    FreeWeights();
+    delete Ft;
+    delete In;
+    delete Hd1;
+    delete Cl1;
+    delete Hd2;
+    delete Cl2;
+    delete Out;
+}
+
 void NnueInit()
 {
-    NnueFt = new NnueFeatureTransformer();
-    NnueIn = new NnueInputSlice();
-    NnueHd1 = new NnueNetworkLayer(NnueIn, 512, 32);
-    NnueCl1 = new NnueClippedRelu(NnueHd1, 32);
-    NnueHd2 = new NnueNetworkLayer(NnueCl1, 32, 32);
-    NnueCl2 = new NnueClippedRelu(NnueHd2, 32);
-    NnueOut = new NnueNetworkLayer(NnueCl2, 32, 1);
+    for (int slot = 0; slot < NNUEMAXNETS; slot++)
+    {
+        NnueNets[slot][0] = new NnueNet();
+        NnueNets[slot][1] = new NnueNet();
+        NnueActiveNet[slot] = NnueNets[slot][0];
+        NnueLoadState[slot] = NNUELOADIDLE;
+    }
+}
+
+// Set the weight pointers of all layers; returns the size of the whole block
+size_t NnueNet::AssignWeights(char *base)
+{
+    size_t offset = Ft->AssignWeights(base, 0);
+    offset = Hd1->AssignWeights(base, offset);
+    offset = Hd2->AssignWeights(base, offset);
+    offset = Out->AssignWeights(base, offset);
+    weights = base;
+    return offset;
+}
+
+static const char* NnueMapFile(string path, size_t *size)
+{
+#ifdef _WIN32
+    HANDLE hFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return nullptr;
+    LARGE_INTEGER filesize;
+    if (!GetFileSizeEx(hFile, &filesize) || !filesize.QuadPart)
+    {
+        CloseHandle(hFile);
+        return nullptr;
+    }
+    HANDLE hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(hFile);
+    if (!hMapping)
+        return nullptr;
+    // the view keeps the mapping alive
+    void *data = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(hMapping);
+    if (!data)
+        return nullptr;
+    *size = (size_t)filesize.QuadPart;
+    return (const char*)data;
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+    struct stat st;
+    if (fstat(fd, &st) || !st.st_size)
+    {
+        close(fd);
+        return nullptr;
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return nullptr;
+    *size = st.st_size;
+    return (const char*)data;
+#endif
+}
+
+static void NnueUnmapFile(const void *data, size_t size)
+{
+#ifdef _WIN32
+    (void)size;
+    UnmapViewOfFile(data);
+#else
+    munmap((void*)data, size);
+#endif
+}
+
+void NnueNet::FreeWeights()
+{
+    if (mapping)
+        NnueUnmapFile(mapping, mappingSize);
+    mapping = nullptr;
+    mappingSize = 0;
+    if (weightsAlloc)
+        freealigned64(weightsAlloc);
+    weightsAlloc = nullptr;
+    AssignWeights(nullptr);
 }
 
 void NnueRemove()
 {
-    delete NnueFt;
-    delete NnueIn;
-    delete NnueHd1;
-    delete NnueCl1;
-    delete NnueHd2;
-    delete NnueCl2;
-    delete NnueOut;
+    NnueWaitForLoad();
+    for (int slot = 0; slot < NNUEMAXNETS; slot++)
+    {
+        delete NnueNets[slot][0];
+        delete NnueNets[slot][1];
+    }
 }
 
-void NnueReadNet(string path)
+// Minimal read-only streambuf to parse a net file from memory
+struct NnueMemBuf : streambuf
 {
-    NnueReady = false;
+    NnueMemBuf(const char *data, size_t size) {
+        char *p = (char*)data;
+        setg(p, p, p + size);
+    }
+};
 
-    uint32_t fthash = NnueFt->GetHash();
-    uint32_t nethash = NnueOut->GetHash();
+// Parse a net in the standard format into an allocated weight block
+bool NnueNet::ParseNet(const char *data, size_t datasize)
+{
+    uint32_t fthash = Ft->GetHash();
+    uint32_t nethash = Out->GetHash();
     uint32_t filehash = (fthash ^ nethash);
 
-    ifstream is(path, ios::binary);
-    if (!is) return;
-    
+    NnueMemBuf mb(data, datasize);
+    istream is(&mb);
+
     uint32_t version, hash, size;
     string sarchitecture;
-    
+
     is.read((char*)&version, sizeof(uint32_t));
     is.read((char*)&hash, sizeof(uint32_t));
     is.read((char*)&size, sizeof(uint32_t));
+    if (!is || size > datasize)
+        return false;
     if (size)
     {
         sarchitecture.resize(size);
         is.read((char*)&sarchitecture[0], size);
     }
 
-    if (version != NNUEFILEVERSION) return;
+    if (version != NNUEFILEVERSION) return false;
 
-    if (hash != filehash) return;
+    if (hash != filehash) return false;
+
+    weightsAlloc = (char*)allocalign64(AssignWeights(nullptr));
+    AssignWeights(weightsAlloc);
 
     is.read((char*)&hash, sizeof(uint32_t));
-    if (hash != fthash) return;
+    if (hash != fthash) return false;
     // Read the weights of the feature transformer
-    if (!NnueFt->ReadWeights(&is)) return;
+    if (!Ft->ReadWeights(&is)) return false;
     is.read((char*)&hash, sizeof(uint32_t));
-    if (hash != nethash) return;
+    if (hash != nethash) return false;
     // Read the weights of the network layers recursively
-    if (!NnueOut->ReadWeights(&is)) return;
+    if (!Out->ReadWeights(&is)) return false;
     if (is.peek() != ios::traits_type::eof())
+        return false;
+    Hd1->TransposeWeights();
+
+    return true;
+}
+
+// Use the weights of a prepared net in place
+bool NnueNet::UseMappedNet(const char *data, size_t datasize)
+{
+    NnueMappedHeader *header = (NnueMappedHeader*)data;
+    size_t weightsize = AssignWeights(nullptr);
+    if (header->layout != NNUEMAPPEDLAYOUT
+        || header->filehash != (Ft->GetHash() ^ Out->GetHash())
+        || header->datasize != weightsize
+        || datasize < sizeof(NnueMappedHeader) + weightsize
+        || ((uintptr_t)data & 63))
+        return false;
+
+    AssignWeights((char*)data + sizeof(NnueMappedHeader));
+    return true;
+}
+
+// Load a net file (or the embedded net) into this net object; it must not be the active net
+bool NnueNet::ReadNet(string path)
+{
+    FreeWeights();
+    if (path == "<empty>")
+        return false;
+
+    const char *data;
+    size_t size;
+    bool mapped = false;
+#ifdef NNUEINCLUDED
+    if (path == NNUEDEFAULTNET)
+    {
+        data = NnueEmbeddedData;
+        size = NnueEmbeddedEnd - NnueEmbeddedData;
+    }
+    else
+#endif
+    {
+        data = NnueMapFile(path, &size);
+        if (!data)
+            return false;
+        mapped = true;
+    }
+
+    if (size >= sizeof(NnueMappedHeader) && memcmp(data, NNUEMAPPEDMAGIC, 8) == 0)
+    {
+        if (!UseMappedNet(data, size))
+        {
+            if (mapped)
+                NnueUnmapFile(data, size);
+            AssignWeights(nullptr);
+            return false;
+        }
+        // keep the mapping; the weights are shared with other processes using the same file
+        if (mapped)
+        {
+            mapping = (void*)data;
+            mappingSize = size;
+        }
+        return true;
+    }
+
+    bool success = ParseNet(data, size);
+    if (mapped)
+        NnueUnmapFile(data, size);
+    if (!success)
+        FreeWeights();
+
+    return success;
+}
+
+static void NnueLoadThreadFunc(string path, int slot)
+{
+    NnueLoadState[slot] = (NnueStandbyNet(slot)->ReadNet(path) ? NNUELOADSUCCESS : NNUELOADFAILED);
+}
+
+static void NnueWaitForLoad(int slot)
+{
+    if (NnueLoadThread[slot].joinable())
+        NnueLoadThread[slot].join();
+}
+
+// Start loading a net into the standby object while the search continues with the active net
+void NnueLoadNetAsync(string path, int slot)
+{
+    NnueWaitForLoad(slot);
+    NnueLoadState[slot] = NNUELOADRUNNING;
+    NnueLoadThread[slot] = thread(&NnueLoadThreadFunc, path, slot);
+}
+
+void NnueWaitForLoad()
+{
+    for (int slot = 0; slot < NNUEMAXNETS; slot++)
+        NnueWaitForLoad(slot);
+}
+
+// Activate the net of a finished load. This has to be called between two searches
+// as the accumulators and caches computed with the old net become invalid.
+// Returns false if there is no finished load.
+bool NnueSwapNet(int slot)
+{
+    int state = NnueLoadState[slot];
+    if (state != NNUELOADSUCCESS && state != NNUELOADFAILED)
+        return false;
+
+    NnueWaitForLoad(slot);
+    bool *ready = (slot == NNUEMAINNET ? &NnueReady : &NnueEndgameReady);
+    if (state == NNUELOADSUCCESS)
+    {
+        NnueActiveNet[slot].store(NnueStandbyNet(slot), memory_order_release);
+        NnueNetGeneration[slot]++;
+        *ready = true;
+    }
+    else
+    {
+        *ready = false;
+    }
+    NnueLoadState[slot] = NNUELOADIDLE;
+
+    return true;
+}
+
+// Load and activate a net immediately
+void NnueReadNet(string path, int slot)
+{
+    NnueWaitForLoad(slot);
+    NnueLoadState[slot] = (NnueStandbyNet(slot)->ReadNet(path) ? NNUELOADSUCCESS : NNUELOADFAILED);
+    NnueSwapNet(slot);
+}
+
+// Batch evaluation of a file with FENs using the thread pool
+static vector<string> evalBatchFens;
+static vector<int> evalBatchScores;
+static atomic<size_t> evalBatchNext;
+
+static void evalBatchJob(searchthread *thr)
+{
+    chessposition *pos = &thr->pos;
+    // the positions of a block are grouped by the net that evaluates them
+    alignas(64) clipped_t input[NNUEMAXNETS][NNUEBATCHBLOCK][NnueFtOutputdims];
+    int index[NNUEMAXNETS][NNUEBATCHBLOCK];
+    int count[NNUEMAXNETS];
+    int scores[NNUEBATCHBLOCK];
+    size_t total = evalBatchFens.size();
+
+    size_t start;
+    while ((start = evalBatchNext.fetch_add(NNUEBATCHBLOCK)) < total)
+    {
+        int num = (int)min((size_t)NNUEBATCHBLOCK, total - start);
+        memset(count, 0, sizeof(count));
+        for (int i = 0; i < num; i++)
+        {
+            if (pos->getFromFen(evalBatchFens[start + i].c_str()) == 0
+                && POPCOUNT(pos->piece00[WKING]) == 1 && POPCOUNT(pos->piece00[BKING]) == 1)
+            {
+                int slot = pos->NnueSelectNet();
+                index[slot][count[slot]] = i;
+                pos->Transform(slot, input[slot][count[slot]++]);
+            }
+        }
+        for (int slot = 0; slot < NNUEMAXNETS; slot++)
+        {
+            if (!count[slot])
+                continue;
+            NnueEvalBatch(slot, &input[slot][0][0], count[slot], scores);
+            for (int j = 0; j < count[slot]; j++)
+                evalBatchScores[start + index[slot][j]] = scores[j];
+        }
+    }
+}
+
+// Evaluate all FENs of fenfile and write them with their score (side to move view) to outfile
+void NnueEvalBatchFile(string fenfile, string outfile)
+{
+    if (!NnueReady)
+    {
+        cout << "info string evalbatch needs a NNUE net.\n";
+        return;
+    }
+    if (en.stopLevel != ENGINETERMINATEDSEARCH)
+    {
+        cout << "info string evalbatch is not possible while searching.\n";
+        return;
+    }
+
+    ifstream is(fenfile);
+    if (!is)
+    {
+        cout << "info string Cannot open " << fenfile << ".\n";
+        return;
+    }
+    string line;
+    evalBatchFens.clear();
+    while (getline(is, line))
+    {
+        if (line.size() && line.back() == '\r')
+            line.pop_back();
+        if (line.size())
+            evalBatchFens.push_back(line);
+    }
+    evalBatchScores.assign(evalBatchFens.size(), NOSCORE);
+    evalBatchNext = 0;
+
+    U64 starttime = getTime();
+    en.runOnThreads(&evalBatchJob);
+    en.waitForThreads();
+    U64 endtime = getTime();
+    // the positions of the threads were used for the evaluation
+    en.prepareThreads();
+
+    ofstream os(outfile);
+    size_t invalid = 0;
+    for (size_t i = 0; i < evalBatchFens.size(); i++)
+    {
+        os << evalBatchFens[i] << ";";
+        if (evalBatchScores[i] == NOSCORE)
+        {
+            os << "invalid\n";
+            invalid++;
+        }
+        else
+        {
+            os << evalBatchScores[i] << "\n";
+        }
+    }
+
+    double seconds = (double)(endtime - starttime) / en.frequency;
+    cout << "info string evalbatch: " << evalBatchFens.size() << " positions (" << invalid << " invalid) in "
+        << fixed << setprecision(3) << seconds << " seconds = " << (size_t)(seconds > 0.0 ? evalBatchFens.size() / seconds : 0)
+        << " positions/s using " << en.Threads << " threads. Scores written to " << outfile << ".\n";
+    cout.unsetf(ios::floatfield);
+
+    evalBatchFens.clear();
+    evalBatchScores.clear();
+}
+
+#ifdef NNUEBENCH
+// Micro benchmark of the NNUE kernels replaying the evaluations of a real search
+struct NnueBenchSample {
+    U64 piece00[14];
+    int kingpos[2];
+    int state;
+    int slot;
+    int walkback;   // plies back to the computed ancestor of the search; 0 if computed already, -1 if a refresh was needed
+    DirtyPiece dirtypiece[NNUEMAXWALKBACK]; // of the moves from the ancestor to this position
+};
+
+#define NNUEBENCHSAMPLES 32768
+#define NNUEBENCHROUNDS 5
+
+#if defined(USE_VNNI)
+#define NNUEKERNELS "AVX-512 VNNI"
+#elif defined(USE_AVX512)
+#define NNUEKERNELS "AVX-512"
+#elif defined(USE_AVX2)
+#define NNUEKERNELS "AVX2"
+#elif defined(USE_SSSE3)
+#define NNUEKERNELS "SSSE3"
+#elif defined(USE_SSE2)
+#define NNUEKERNELS "SSE2"
+#elif defined(USE_DOTPROD)
+#define NNUEKERNELS "NEON dotprod"
+#elif defined(USE_NEON)
+#define NNUEKERNELS "NEON"
+#else
+#define NNUEKERNELS "generic"
+#endif
+
+typedef int16_t NnueBenchAccumulation[2][256];
+
+static vector<NnueBenchSample> NnueBenchSamples;
+static NnueBenchAccumulation *NnueBenchParents = NULL;
+
+void chessposition::NnueBenchRecord(int slot)
+{
+    size_t i = NnueBenchSamples.size();
+    if (i >= NNUEBENCHSAMPLES)
+        return;
+    if (!NnueBenchParents && !(NnueBenchParents = (NnueBenchAccumulation*)allocalign64(NNUEBENCHSAMPLES * sizeof(NnueBenchAccumulation))))
         return;
 
-    NnueReady = true;
+    NnueBenchSample bs;
+    memcpy(bs.piece00, piece00, sizeof(bs.piece00));
+    bs.kingpos[0] = kingpos[0];
+    bs.kingpos[1] = kingpos[1];
+    bs.state = state;
+    bs.slot = slot;
+
+    // the same ancestor that UpdateAccumulator will start from
+    const int computed = (1 << slot);
+    int ancestor = mstop;
+    while (ancestor > 0 && mstop - ancestor < NNUEMAXWALKBACK && !(accumulator[ancestor].computationState & computed))
+        ancestor--;
+    bs.walkback = (accumulator[ancestor].computationState & computed) ? mstop - ancestor : -1;
+    if (bs.walkback > 0)
+    {
+        memcpy(NnueBenchParents[i], accumulator[ancestor].accumulation[slot], sizeof(NnueBenchAccumulation));
+        for (int k = 0; k < bs.walkback; k++)
+            bs.dirtypiece[k] = dirtypiece[ancestor + 1 + k];
+    }
+    NnueBenchSamples.push_back(bs);
+}
+
+static void NnueBenchSetBoard(chessposition *pos, NnueBenchSample *bs)
+{
+    memcpy(pos->piece00, bs->piece00, sizeof(bs->piece00));
+    pos->kingpos[0] = bs->kingpos[0];
+    pos->kingpos[1] = bs->kingpos[1];
+    pos->state = bs->state;
+}
+
+// Position with an empty accumulator that has to be refreshed
+static void NnueBenchSetRefresh(chessposition *pos, size_t i)
+{
+    NnueBenchSetBoard(pos, &NnueBenchSamples[i]);
+    pos->mstop = 0;
+    pos->accumulator[0].computationState = 0;
+}
+
+// Position with the recorded parent accumulator and the moves of the search that lead to the sample
+static void NnueBenchSetUpdate(chessposition *pos, size_t i)
+{
+    NnueBenchSample *bs = &NnueBenchSamples[i];
+    NnueBenchSetBoard(pos, bs);
+    pos->mstop = bs->walkback;
+    memcpy(pos->accumulator[0].accumulation[bs->slot], NnueBenchParents[i], sizeof(NnueBenchAccumulation));
+    pos->accumulator[0].computationState = (1 << bs->slot);
+    for (int k = 1; k <= bs->walkback; k++)
+    {
+        pos->dirtypiece[k] = bs->dirtypiece[k - 1];
+        pos->accumulator[k].computationState = 0;
+    }
+}
+
+// Position with the computed accumulator of the sample
+static void NnueBenchSetTransform(chessposition *pos, NnueBenchAccumulation *acc, size_t i)
+{
+    int slot = NnueBenchSamples[i].slot;
+    pos->mstop = 0;
+    memcpy(pos->accumulator[0].accumulation[slot], acc[i], sizeof(NnueBenchAccumulation));
+    pos->accumulator[0].computationState = (1 << slot);
+}
+
+// Bytes of the feature transformer touched when the accumulator half of perspective c is computed from the Finny table
+static size_t NnueBenchCacheBytes(chessposition *pos, int slot, int c)
+{
+    NnueFinnyEntry *fe = &pos->finnytable[slot].entry[c][pos->kingpos[c]];
+    bool valid = fe->valid && pos->finnytable[slot].netgeneration == NnueNetGeneration[slot];
+    int changes = 0;
+    for (int pc = WPAWN; pc <= BQUEEN; pc++)
+        changes += POPCOUNT(valid ? fe->piece00[pc] ^ pos->piece00[pc] : pos->piece00[pc]);
+    // read and write of the cache entry, copy to the accumulator, the columns of the changed features and maybe the bias
+    return (3 + changes + !valid) * NnueFtHalfdims * sizeof(int16_t);
+}
+
+static size_t NnueBenchUpdateBytes(chessposition *pos, int slot)
+{
+    size_t bytes = 0;
+    for (int c = 0; c < 2; c++)
+    {
+        bool reset = false;
+        NnueIndexList add, remove;
+        add.size = remove.size = 0;
+        for (int k = 1; k <= pos->mstop; k++)
+        {
+            DirtyPiece *dp = &pos->dirtypiece[k];
+            reset = reset || (dp->dirtyNum && dp->pc[0] == (PieceCode)(WKING | c));
+            pos->HalfkpAppendChangedIndices(c, dp, &add, &remove);
+        }
+        if (reset)
+            bytes += NnueBenchCacheBytes(pos, slot, c);
+        else
+            // read of the parent, write of the result and the columns of the changed features
+            bytes += (2 + add.size + remove.size) * NnueFtHalfdims * sizeof(int16_t);
+    }
+    return bytes;
+}
+
+static void NnueBenchResetCache(chessposition *pos)
+{
+    for (int slot = 0; slot < NNUEMAXNETS; slot++)
+        pos->finnytable[slot].netgeneration = -1;
+}
+
+static size_t NnueBenchLayerBytes(NnueNetworkLayer *layer, clipped_t *input)
+{
+    size_t weightbytes = (size_t)layer->inputdims * layer->outputdims;
+#ifdef NNUESPARSEPROPAGATE
+    if (layer->sparse)
+    {
+        uint32_t *in32 = (uint32_t*)input;
+        weightbytes = 0;
+        for (int i = 0; i < layer->inputdims / 4; i++)
+            if (in32[i])
+                weightbytes += 4 * layer->outputdims;
+    }
+#else
+    (void)input;
+#endif
+    return weightbytes + layer->inputdims * sizeof(clipped_t) + 2 * layer->outputdims * sizeof(int32_t);
 }
-#endif
\ No newline at end of file
+
+struct NnueBenchResult {
+    const char *name;
+    U64 ticks;
+    size_t bytes;
+    size_t ops;
+};
+
+static double NnueBenchPrint(NnueBenchResult *r)
+{
+    size_t ops = max(r->ops, (size_t)1);
+    double ns = (double)r->ticks * 1e9 / en.frequency / ops;
+    double bytes = (double)r->bytes / ops;
+    printf("%-22s %10.1f %12.0f %10.2f\n", r->name, ns, bytes, ns > 0.0 ? bytes / ns : 0.0);
+    return ns;
+}
+
+// Replay the recorded evaluations stage by stage; each stage is measured NNUEBENCHROUNDS times and the fastest round counts.
+// The cost of setting up the position (and copying the accumulator) is measured alone and subtracted.
+void NnueBenchReplay()
+{
+    size_t n = NnueBenchSamples.size();
+    if (!n)
+    {
+        cout << "No NNUE evaluations recorded.\n";
+        return;
+    }
+
+    chessposition *pos = &en.sthread[0].pos;
+    NnueBenchAccumulation *computedacc = (NnueBenchAccumulation*)allocalign64(n * sizeof(NnueBenchAccumulation));
+    clipped_t *input = (clipped_t*)allocalign64(n * NnueFtOutputdims * sizeof(clipped_t));
+    int32_t *hidden1 = (int32_t*)allocalign64(n * 32 * sizeof(int32_t));
+    clipped_t *clipped1 = (clipped_t*)allocalign64(n * 32 * sizeof(clipped_t));
+    int32_t *hidden2 = (int32_t*)allocalign64(n * 32 * sizeof(int32_t));
+    clipped_t *clipped2 = (clipped_t*)allocalign64(n * 32 * sizeof(clipped_t));
+    int32_t *out = (int32_t*)allocalign64(n * sizeof(int32_t));
+    if (!computedacc || !input || !hidden1 || !clipped1 || !hidden2 || !clipped2 || !out)
+    {
+        cout << "Not enough memory for the NNUE benchmark.\n";
+        n = 0;
+    }
+
+    // the incremental updates of the search with the parent accumulators it started from
+    vector<size_t> updates;
+    for (size_t i = 0; i < n; i++)
+        if (NnueBenchSamples[i].walkback > 0)
+            updates.push_back(i);
+    size_t nu = updates.size();
+
+    enum { Refresh, Update, Transform, Hidden1, Clipped1, Hidden2, Clipped2, Output, NumStages };
+    NnueBenchResult result[NumStages] = {
+        { "RefreshAccumulator", 0, 0, n },
+        { "UpdateAccumulator", 0, 0, nu },
+        { "Transform", 0, 0, n },
+#ifdef NNUESPARSEPROPAGATE
+        { "Hidden1 (sparse)", 0, 0, n },
+#else
+        { "Hidden1", 0, 0, n },
+#endif
+        { "ClippedRelu1", 0, 0, n },
+        { "Hidden2", 0, 0, n },
+        { "ClippedRelu2", 0, 0, n },
+        { "Output", 0, 0, n },
+    };
+
+    // Untimed passes that compute the accumulators, the real inputs of the layers and the bytes of the accumulator stages
+    NnueBenchResetCache(pos);
+    for (size_t i = 0; i < n; i++)
+    {
+        NnueBenchSample *bs = &NnueBenchSamples[i];
+        NnueBenchSetRefresh(pos, i);
+        result[Refresh].bytes += NnueBenchCacheBytes(pos, bs->slot, 0) + NnueBenchCacheBytes(pos, bs->slot, 1);
+        pos->RefreshAccumulator(bs->slot);
+        memcpy(computedacc[i], pos->accumulator[0].accumulation[bs->slot], sizeof(NnueBenchAccumulation));
+        pos->Transform(bs->slot, input + i * NnueFtOutputdims);
+        result[Transform].bytes += 2 * NnueFtHalfdims * sizeof(int16_t) + NnueFtOutputdims * sizeof(clipped_t);
+    }
+    NnueBenchResetCache(pos);
+    for (size_t u = 0; u < nu; u++)
+    {
+        NnueBenchSetUpdate(pos, updates[u]);
+        result[Update].bytes += NnueBenchUpdateBytes(pos, NnueBenchSamples[updates[u]].slot);
+        pos->UpdateAccumulator(NnueBenchSamples[updates[u]].slot);
+    }
+
+    U64 t0;
+    U64 ticks[NumStages], setupticks[Transform + 1];
+    for (int s = 0; s < NumStages; s++)
+        ticks[s] = ~0ULL;
+    for (int s = 0; s <= Transform; s++)
+        setupticks[s] = ~0ULL;
+    for (int r = 0; r < NNUEBENCHROUNDS; r++)
+    {
+        t0 = getTime();
+        for (size_t i = 0; i < n; i++)
+            NnueBenchSetRefresh(pos, i);
+        setupticks[Refresh] = min(setupticks[Refresh], getTime() - t0);
+
+        t0 = getTime();
+        for (size_t u = 0; u < nu; u++)
+            NnueBenchSetUpdate(pos, updates[u]);
+        setupticks[Update] = min(setupticks[Update], getTime() - t0);
+
+        t0 = getTime();
+        for (size_t i = 0; i < n; i++)
+            NnueBenchSetTransform(pos, computedacc, i);
+        setupticks[Transform] = min(setupticks[Transform], getTime() - t0);
+    }
+
+    for (int r = 0; r < NNUEBENCHROUNDS; r++)
+    {
+        NnueBenchResetCache(pos);
+        t0 = getTime();
+        for (size_t i = 0; i < n; i++)
+        {
+            NnueBenchSetRefresh(pos, i);
+            pos->RefreshAccumulator(NnueBenchSamples[i].slot);
+        }
+        ticks[Refresh] = min(ticks[Refresh], getTime() - t0);
+
+        NnueBenchResetCache(pos);
+        t0 = getTime();
+        for (size_t u = 0; u < nu; u++)
+        {
+            NnueBenchSetUpdate(pos, updates[u]);
+            pos->UpdateAccumulator(NnueBenchSamples[updates[u]].slot);
+        }
+        ticks[Update] = min(ticks[Update], getTime() - t0);
+
+        alignas(64) clipped_t transformed[NnueFtOutputdims];
+        t0 = getTime();
+        for (size_t i = 0; i < n; i++)
+        {
+            NnueBenchSetTransform(pos, computedacc, i);
+            pos->Transform(NnueBenchSamples[i].slot, transformed);
+        }
+        ticks[Transform] = min(ticks[Transform], getTime() - t0);
+
+        t0 = getTime();
+        for (size_t i = 0; i < n; i++)
+            NnueCurrentNet(NnueBenchSamples[i].slot)->Hd1->Propagate(input + i * NnueFtOutputdims, hidden1 + i * 32);
+        ticks[Hidden1] = min(ticks[Hidden1], getTime() - t0);
+
+        t0 = getTime();
+        for (size_t i = 0; i < n; i++)
+            NnueCurrentNet(NnueBenchSamples[i].slot)->Cl1->Propagate(hidden1 + i * 32, clipped1 + i * 32);
+        ticks[Clipped1] = min(ticks[Clipped1], getTime() - t0);
+
+        t0 = getTime();
+        for (size_t i = 0; i < n; i++)
+            NnueCurrentNet(NnueBenchSamples[i].slot)->Hd2->Propagate(clipped1 + i * 32, hidden2 + i * 32);
+        ticks[Hidden2] = min(ticks[Hidden2], getTime() - t0);
+
+        t0 = getTime();
+        for (size_t i = 0; i < n; i++)
+            NnueCurrentNet(NnueBenchSamples[i].slot)->Cl2->Propagate(hidden2 + i * 32, clipped2 + i * 32);
+        ticks[Clipped2] = min(ticks[Clipped2], getTime() - t0);
+
+        t0 = getTime();
+        for (size_t i = 0; i < n; i++)
+            NnueCurrentNet(NnueBenchSamples[i].slot)->Out->Propagate(clipped2 + i * 32, out + i);
+        ticks[Output] = min(ticks[Output], getTime() - t0);
+    }
+    for (int s = 0; s <= Transform; s++)
+        ticks[s] -= min(ticks[s], setupticks[s]);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        NnueNet *net = NnueCurrentNet(NnueBenchSamples[i].slot);
+        result[Hidden1].bytes += NnueBenchLayerBytes(net->Hd1, input + i * NnueFtOutputdims);
+        result[Clipped1].bytes += 32 * (sizeof(int32_t) + sizeof(clipped_t));
+        result[Hidden2].bytes += NnueBenchLayerBytes(net->Hd2, clipped1 + i * 32);
+        result[Clipped2].bytes += 32 * (sizeof(int32_t) + sizeof(clipped_t));
+        result[Output].bytes += NnueBenchLayerBytes(net->Out, clipped2 + i * 32);
+    }
+
+    if (n)
+    {
+        printf("\nNNUE kernel benchmark: %d evaluations with %d incremental updates replayed, %s kernels\n", (int)n, (int)nu, NNUEKERNELS);
+        printf("%-22s %10s %12s %10s\n", "Kernel", "ns/op", "bytes/op", "bytes/ns");
+        double evalns = 0.0;
+        for (int s = 0; s < NumStages; s++)
+        {
+            result[s].ticks = ticks[s];
+            double ns = NnueBenchPrint(&result[s]);
+            if (s != Refresh)
+                evalns += ns;
+        }
+        printf("Evaluation with incremental update: %.1f ns\n", evalns);
+        printf("Only the kernels of this build are compiled in; run the other binaries of 'make all' to compare the SIMD variants.\n");
+    }
+
+    freealigned64(computedacc);
+    freealigned64(input);
+    freealigned64(hidden1);
+    freealigned64(clipped1);
+    freealigned64(hidden2);
+    freealigned64(clipped2);
+    freealigned64(out);
+    freealigned64(NnueBenchParents);
+    NnueBenchParents = NULL;
+    NnueBenchSamples.clear();
+    // the position of thread 0 was used for the replay
+    en.prepareThreads();
+}
+#endif
+
+// Write the loaded net in the runtime layout so that it can be mapped directly
+bool NnueWriteMappedNet(string path)
+{
+    if (!NnueReady)
+        return false;
+
+    return NnueCurrentNet(NNUEMAINNET)->WriteMappedNet(path);
+}
+
+bool NnueNet::WriteMappedNet(string path)
+{
+    NnueMappedHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, NNUEMAPPEDMAGIC, sizeof(header.magic));
+    header.layout = NNUEMAPPEDLAYOUT;
+    header.filehash = Ft->GetHash() ^ Out->GetHash();
+    header.datasize = AssignWeights(weights);
+
+    ofstream os(path, ios::binary);
+    if (!os)
+        return false;
+    os.write((char*)&header, sizeof(header));
+    os.write(weights, header.datasize);
+
+    return !os.fail();
+}
+#endif
@@ -18,10 +18,6 @@
 
 #include "RubiChess.h"
 
-#ifdef STATISTICS
-statistic statistics;
-#endif
-
 #ifdef SEARCHOPTIONS
 void searchtableinit();
 class searchparam {
@@ -105,6 +101,51 @@ int lmptable[2][MAXLMPDEPTH];
 static const int SkipSize[16] = { 1, 1, 1, 2, 2, 2, 1, 3, 2, 2, 1, 3, 3, 2, 2, 1 };
 static const int SkipDepths[16] = { 1, 2, 2, 4, 4, 3, 2, 5, 4, 3, 2, 6, 5, 4, 3, 2 };
 
+// ABDADA: lock-free table of the child positions some thread is currently searching
+// An entry holds the upper bits of the hash and the depth of the searching node in the lowest byte
+#define ABDADAMINDEPTH 3
+#define ABDADABUCKETS (1 << 14)
+#define ABDADAWAYS 4
+#define ABDADAMAXDEFERRED 32
+static atomic<U64> abdadatable[ABDADABUCKETS][ABDADAWAYS];
+
+static bool abdadaIsSearched(U64 hash, int depth)
+{
+    atomic<U64> *bucket = abdadatable[(hash >> 8) & (ABDADABUCKETS - 1)];
+    for (int i = 0; i < ABDADAWAYS; i++)
+    {
+        U64 e = bucket[i].load(memory_order_relaxed);
+        if (!((e ^ hash) & ~0xffULL) && (int)(e & 0xff) >= depth)
+            return true;
+    }
+    return false;
+}
+
+static void abdadaStartSearch(U64 hash, int depth)
+{
+    U64 entry = (hash & ~0xffULL) | depth;
+    atomic<U64> *bucket = abdadatable[(hash >> 8) & (ABDADABUCKETS - 1)];
+    for (int i = 0; i < ABDADAWAYS; i++)
+    {
+        U64 e = bucket[i].load(memory_order_relaxed);
+        if (e == entry || (!e && bucket[i].compare_exchange_strong(e, entry, memory_order_relaxed)))
+            return;
+    }
+    // bucket full; just replace the first entry
+    bucket[0].store(entry, memory_order_relaxed);
+}
+
+static void abdadaFinishSearch(U64 hash, int depth)
+{
+    U64 entry = (hash & ~0xffULL) | depth;
+    atomic<U64> *bucket = abdadatable[(hash >> 8) & (ABDADABUCKETS - 1)];
+    for (int i = 0; i < ABDADAWAYS; i++)
+    {
+        U64 e = entry;
+        bucket[i].compare_exchange_strong(e, 0, memory_order_relaxed);
+    }
+}
+
 
 void searchtableinit()
 {
@@ -615,158 +656,204 @@ int chessposition::alphabeta(int alpha, int beta, int depth)
     int legalMoves = 0;
     int quietsPlayed = 0;
     uint32_t quietMoves[MAXMOVELISTLENGTH];
-    while ((m = ms.next()))
+
+    // ABDADA: at non-PV nodes moves whose child is searched by another thread are deferred to the end
+    const bool useAbdada = en.abdada && en.Threads > 1 && !PVNode && depth >= ABDADAMINDEPTH;
+    struct {
+        uint32_t code;
+        int reduction;
+        int effectiveDepth;
+    } deferred[ABDADAMAXDEFERRED];
+    int deferredNum = 0;
+    int deferredIndex = -1;     // -1 while the moves come from the move selector
+    chessmove deferredMove;
+    while (true)
     {
-        ms.legalmovenum++;
+        if (deferredIndex < 0 && !(m = ms.next()))
+            deferredIndex = 0;
+        if (deferredIndex >= 0)
+        {
+            if (deferredIndex >= deferredNum)
+                break;
+            deferredMove.code = deferred[deferredIndex++].code;
+            m = &deferredMove;
+        }
+        else
+        {
+            ms.legalmovenum++;
+        }
 #ifdef SDEBUG
         bool isDebugMove = (debugMove.code == m->code);
         SDEBUGDO(isDebugMove, pvmovenum[ply] = legalMoves + 1;);
         SDEBUGDO((isDebugPv && pvmovenum[ply] <= 0), pvmovenum[ply] = -(legalMoves + 1););
 #endif
-        STATISTICSINC(moves_n[(bool)ISTACTICAL(m->code)]);
-        // Leave out the move to test for singularity
-        if ((m->code & 0xffff) == excludeMove)
-            continue;
-
-        // Late move pruning
-        if (depth < MAXLMPDEPTH && !ISTACTICAL(m->code) && bestscore > NOSCORE && quietsPlayed > lmptable[positionImproved][depth])
+        int reduction;
+        bool futilityPrune;
+        if (deferredIndex > 0)
         {
-            // Proceed to next moveselector state manually to save some time
-            ms.state++;
-            STATISTICSINC(moves_pruned_lmp);
-            SDEBUGDO(isDebugMove, pvaborttype[ply] = PVA_LMPRUNED;);
-            continue;
+            // deferred move; pruning, extension and reduction were decided in the first pass
+            reduction = deferred[deferredIndex - 1].reduction;
+            effectiveDepth = deferred[deferredIndex - 1].effectiveDepth;
+            futilityPrune = false;
         }
-
-        // Check for futility pruning condition for this move and skip move if at least one legal move is already found
-        bool futilityPrune = futility && !ISTACTICAL(m->code) && !isCheckbb && alpha <= 900 && !moveGivesCheck(m->code);
-        if (futilityPrune)
+        else
         {
-            if (legalMoves)
+            STATISTICSINC(moves_n[(bool)ISTACTICAL(m->code)]);
+            // Leave out the move to test for singularity
+            if ((m->code & 0xffff) == excludeMove)
+                continue;
+
+            // Late move pruning
+            if (depth < MAXLMPDEPTH && !ISTACTICAL(m->code) && bestscore > NOSCORE && quietsPlayed > lmptable[positionImproved][depth])
             {
-                STATISTICSINC(moves_pruned_futility);
-                SDEBUGDO(isDebugMove, pvaborttype[ply] = PVA_FUTILITYPRUNED;);
+                // Proceed to next moveselector state manually to save some time
+                ms.state++;
+                STATISTICSINC(moves_pruned_lmp);
+                SDEBUGDO(isDebugMove, pvaborttype[ply] = PVA_LMPRUNED;);
                 continue;
             }
-            else if (staticeval > bestscore)
+
+            // Check for futility pruning condition for this move and skip move if at least one legal move is already found
+            futilityPrune = futility && !ISTACTICAL(m->code) && !isCheckbb && alpha <= 900 && !moveGivesCheck(m->code);
+            if (futilityPrune)
             {
-                // Use the static score from futility test as a bestscore start value
-                bestscore = staticeval;
+                if (legalMoves)
+                {
+                    STATISTICSINC(moves_pruned_futility);
+                    SDEBUGDO(isDebugMove, pvaborttype[ply] = PVA_FUTILITYPRUNED;);
+                    continue;
+                }
+                else if (staticeval > bestscore)
+                {
+                    // Use the static score from futility test as a bestscore start value
+                    bestscore = staticeval;
+                }
             }
-        }
 
-        // Prune moves with bad SEE
-        if (!isCheckbb && depth <= sps.seeprunemaxdepth && bestscore > NOSCORE && ms.state >= QUIETSTATE && !see(m->code, sps.seeprunemarginperdepth * depth * (ISTACTICAL(m->code) ? depth : sps.seeprunequietfactor)))
-        {
-            STATISTICSINC(moves_pruned_badsee);
-            SDEBUGDO(isDebugMove, pvaborttype[ply] = PVA_SEEPRUNED;);
-            continue;
-        }
-
-        int stats = getHistory(m->code, ms.cmptr);
-        int extendMove = 0;
-        int pc = GETPIECE(m->code);
-        int to = GETCORRECTTO(m->code);
-
-        // Singular extension
-        if ((m->code & 0xffff) == hashmovecode
-            && depth >= sps.singularmindepth
-            && !excludeMove
-            && tp.probeHash(newhash, &hashscore, &staticeval, &hashmovecode, depth - 3, alpha, beta, ply)  // FIXME: maybe needs hashscore = FIXMATESCOREPROBE(hashscore, ply);
-            && hashscore > alpha)
-        {
-            excludemovestack[mstop - 1] = hashmovecode;
-            int sBeta = max(hashscore - sps.singularmarginperdepth * depth, SCOREBLACKWINS);
-            int redScore = alphabeta(sBeta - 1, sBeta, depth / 2);
-            excludemovestack[mstop - 1] = 0;
-
-            if (redScore < sBeta)
+            // Prune moves with bad SEE
+            if (!isCheckbb && depth <= sps.seeprunemaxdepth && bestscore > NOSCORE && ms.state >= QUIETSTATE && !see(m->code, sps.seeprunemarginperdepth * depth * (ISTACTICAL(m->code) ? depth : sps.seeprunequietfactor)))
             {
-                // Move is singular
-                STATISTICSINC(extend_singular);
-                extendMove = 1;
+                STATISTICSINC(moves_pruned_badsee);
+                SDEBUGDO(isDebugMove, pvaborttype[ply] = PVA_SEEPRUNED;);
+                continue;
             }
-            else if (bestknownscore >= beta && sBeta >= beta)
+
+            int stats = getHistory(m->code, ms.cmptr);
+            int extendMove = 0;
+            int pc = GETPIECE(m->code);
+            int to = GETCORRECTTO(m->code);
+
+            // Singular extension
+            if ((m->code & 0xffff) == hashmovecode
+                && depth >= sps.singularmindepth
+                && !excludeMove
+                && tp.probeHash(newhash, &hashscore, &staticeval, &hashmovecode, depth - 3, alpha, beta, ply)  // FIXME: maybe needs hashscore = FIXMATESCOREPROBE(hashscore, ply);
+                && hashscore > alpha)
             {
-                // Hashscore for lower depth and static eval cut and we have at least a second good move => lets cut here
-                STATISTICSINC(prune_multicut);
-                SDEBUGDO(isDebugPv, pvabortval[ply] = sBeta; pvaborttype[ply] = PVA_MULTICUT;);
-                return sBeta;
+                excludemovestack[mstop - 1] = hashmovecode;
+                int sBeta = max(hashscore - sps.singularmarginperdepth * depth, SCOREBLACKWINS);
+                int redScore = alphabeta(sBeta - 1, sBeta, depth / 2);
+                excludemovestack[mstop - 1] = 0;
+
+                if (redScore < sBeta)
+                {
+                    // Move is singular
+                    STATISTICSINC(extend_singular);
+                    extendMove = 1;
+                }
+                else if (bestknownscore >= beta && sBeta >= beta)
+                {
+                    // Hashscore for lower depth and static eval cut and we have at least a second good move => lets cut here
+                    STATISTICSINC(prune_multicut);
+                    SDEBUGDO(isDebugPv, pvabortval[ply] = sBeta; pvaborttype[ply] = PVA_MULTICUT;);
+                    return sBeta;
+                }
             }
-        }
-        // Extend captures that lead into endgame
-        else if (ph > 200 && GETCAPTURE(m->code) >= WKNIGHT)
-        {
-            STATISTICSINC(extend_endgame);
-            extendMove = 1;
-        }
-        else if(!ISTACTICAL(m->code) && ms.cmptr[0] && ms.cmptr[1])
-        {
-            if (ms.cmptr[0][pc * 64 + to] > he_threshold && ms.cmptr[1][pc * 64 + to] > he_threshold)
+            // Extend captures that lead into endgame
+            else if (ph > 200 && GETCAPTURE(m->code) >= WKNIGHT)
             {
-                STATISTICSINC(extend_history);
+                STATISTICSINC(extend_endgame);
                 extendMove = 1;
-                he_yes++;
             }
-            if ((++he_all & 0x3fffff) == 0)
+            else if(!ISTACTICAL(m->code) && ms.cmptr[0] && ms.cmptr[1])
             {
-                // adjust history extension threshold
-                if (he_all / (1ULL << sps.histextminthreshold) < he_yes)
+                if (ms.cmptr[0][pc * 64 + to] > he_threshold && ms.cmptr[1][pc * 64 + to] > he_threshold)
                 {
-                    // 1/512 ~ extension ratio > 0.1953% ==> increase threshold
-                    he_threshold = he_threshold * 257 / 256;
-                    he_all = he_yes = 0ULL;
-                } else if (he_all / (1ULL << sps.histextmaxthreshold) > he_yes)
+                    STATISTICSINC(extend_history);
+                    extendMove = 1;
+                    he_yes++;
+                }
+                if ((++he_all & 0x3fffff) == 0)
                 {
-                    // 1/32768 ~ extension ratio < 0.0030% ==> decrease threshold
-                    he_threshold = he_threshold * 255 / 256;
-                    he_all = he_yes = 0ULL;
+                    // adjust history extension threshold
+                    if (he_all / (1ULL << sps.histextminthreshold) < he_yes)
+                    {
+                        // 1/512 ~ extension ratio > 0.1953% ==> increase threshold
+                        he_threshold = he_threshold * 257 / 256;
+                        he_all = he_yes = 0ULL;
+                    } else if (he_all / (1ULL << sps.histextmaxthreshold) > he_yes)
+                    {
+                        // 1/32768 ~ extension ratio < 0.0030% ==> decrease threshold
+                        he_threshold = he_threshold * 255 / 256;
+                        he_all = he_yes = 0ULL;
+                    }
                 }
             }
-        }
 
-        // Late move reduction
-        int reduction = 0;
-        if (depth >= sps.lmrmindepth && !ISTACTICAL(m->code))
-        {
-            reduction = reductiontable[positionImproved][depth][min(63, legalMoves + 1)];
+            // Late move reduction
+            reduction = 0;
+            if (depth >= sps.lmrmindepth && !ISTACTICAL(m->code))
+            {
+                reduction = reductiontable[positionImproved][depth][min(63, legalMoves + 1)];
 
-            // adjust reduction by stats value
-            reduction -= stats / (sps.lmrstatsratio * 8);
+                // adjust reduction by stats value
+                reduction -= stats / (sps.lmrstatsratio * 8);
 
-            // adjust reduction at PV nodes
-            reduction -= PVNode;
+                // adjust reduction at PV nodes
+                reduction -= PVNode;
 
-            // adjust reduction with opponents move number
-            reduction -= (LegalMoves[ply] >= sps.lmropponentmovecount);
+                // adjust reduction with opponents move number
+                reduction -= (LegalMoves[ply] >= sps.lmropponentmovecount);
 
-            STATISTICSINC(red_pi[positionImproved]);
-            STATISTICSADD(red_lmr[positionImproved], reductiontable[positionImproved][depth][min(63, legalMoves + 1)]);
-            STATISTICSADD(red_history, -stats / (sps.lmrstatsratio * 8));
-            STATISTICSADD(red_pv, -(int)PVNode);
-            STATISTICSDO(int red0 = reduction);
+                STATISTICSINC(red_pi[positionImproved]);
+                STATISTICSADD(red_lmr[positionImproved], reductiontable[positionImproved][depth][min(63, legalMoves + 1)]);
+                STATISTICSADD(red_history, -stats / (sps.lmrstatsratio * 8));
+                STATISTICSADD(red_pv, -(int)PVNode);
+                STATISTICSDO(int red0 = reduction);
 
-            reduction = min(depth, max(0, reduction));
+                reduction = min(depth, max(0, reduction));
 
-            STATISTICSDO(int red1 = reduction);
-            STATISTICSADD(red_correction, red1 - red0);
-            STATISTICSADD(red_total, reduction);
-        }
+                STATISTICSDO(int red1 = reduction);
+                STATISTICSADD(red_correction, red1 - red0);
+                STATISTICSADD(red_total, reduction);
+            }
 
-        effectiveDepth = depth + extendall - reduction + extendMove;
+            effectiveDepth = depth + extendall - reduction + extendMove;
 
-        // Prune moves with bad counter move history
-        if (!ISTACTICAL(m->code) && effectiveDepth < 4
-            && ms.cmptr[0] && ms.cmptr[0][pc * 64 + to] < 0
-            && ms.cmptr[1] && ms.cmptr[1][pc * 64 + to] < 0)
-        {
-            SDEBUGDO(isDebugMove, pvaborttype[ply] = PVA_BADHISTORYPRUNED;);
-            continue;
+            // Prune moves with bad counter move history
+            if (!ISTACTICAL(m->code) && effectiveDepth < 4
+                && ms.cmptr[0] && ms.cmptr[0][pc * 64 + to] < 0
+                && ms.cmptr[1] && ms.cmptr[1][pc * 64 + to] < 0)
+            {
+                SDEBUGDO(isDebugMove, pvaborttype[ply] = PVA_BADHISTORYPRUNED;);
+                continue;
+            }
         }
 
         if (!playMove(m))
             continue;
 
+        if (useAbdada && legalMoves && deferredIndex < 0 && deferredNum < ABDADAMAXDEFERRED && abdadaIsSearched(hash, depth))
+        {
+            // another thread is searching this child; try again after the other moves
+            unplayMove(m);
+            deferred[deferredNum].code = m->code;
+            deferred[deferredNum].reduction = reduction;
+            deferred[deferredNum].effectiveDepth = effectiveDepth;
+            deferredNum++;
+            continue;
+        }
+
         legalMoves++;
         SDEBUGDO(isDebugMove, debugMovePlayed = true;)
 
@@ -783,6 +870,10 @@ int chessposition::alphabeta(int alpha, int beta, int depth)
         LegalMoves[ply] = ms.legalmovenum;
         SDEBUGDO(isDebugMove, pvadditionalinfo[ply-1] = ""; );
 
+        U64 childhash = hash;
+        if (useAbdada)
+            abdadaStartSearch(childhash, depth);
+
         if (reduction)
         {
             // LMR search; test against alpha
@@ -808,6 +899,8 @@ int chessposition::alphabeta(int alpha, int beta, int depth)
             SDEBUGDO(isDebugMove, pvadditionalinfo[ply-1] += "PVS(alpha=" + to_string(alpha)+ ",beta=" +to_string(beta) + "/depth=" + to_string(effectiveDepth - 1) + ");score=" + to_string(score) + "..."; );
         }
         SDEBUGDO(isDebugMove, pvadditionalinfo[ply - 1] += "score=" + to_string(score) + "  "; );
+        if (useAbdada)
+            abdadaFinishSearch(childhash, depth);
         unplayMove(m);
 
         if (en.stopLevel == ENGINESTOPIMMEDIATELY)
@@ -959,6 +1052,9 @@ int chessposition::rootsearch(int alpha, int beta, int depth, int inWindowLast)
 
     if (!tbPosition)
     {
+        U64 hint = en.rootHint.load(memory_order_relaxed);
+        uint32_t hintmove = ((int)(hint >> 32) >= depth ? (uint32_t)hint : 0);
+
         // Reset move values
         for (int i = 0; i < rootmovelist.length; i++)
         {
@@ -967,6 +1063,9 @@ int chessposition::rootsearch(int alpha, int beta, int depth, int inWindowLast)
             //PV moves gets top score
             if (hashmovecode == (m->code & 0xffff))
                 m->value = PVVAL;
+            // best move of a deeper helper thread comes next
+            else if (hintmove == m->code)
+                m->value = PVVAL - 1;
             else if (bestFailingLow == m->code)
                 m->value = KILLERVAL2 - 1;
             // killermoves gets score better than non-capture
@@ -1201,6 +1300,65 @@ static void uciScore(searchthread *thr, int inWindow, U64 nowtime, int score, in
 }
 
 
+// Thread voting: every thread with a completed iteration votes for its best move, weighted by
+// its completed depth and the distance of its score to the worst score; proven wins come first
+static searchthread* selectBestThread(searchthread *mainthr)
+{
+    searchthread *bestthr = mainthr;
+    int minscore = SCOREWHITEWINS;
+    for (int i = 0; i < en.Threads; i++)
+    {
+        chessposition *hpos = &en.sthread[i].pos;
+        if (en.sthread[i].lastCompleteDepth && hpos->bestmove.code)
+            minscore = min(minscore, hpos->bestmovescore[0]);
+    }
+
+    U64 bestvotes = 0;
+    for (int i = 0; i < en.Threads; i++)
+    {
+        searchthread *hthr = &en.sthread[i];
+        if (!hthr->lastCompleteDepth || !hthr->pos.bestmove.code)
+            continue;
+
+        U64 votes = 0;
+        for (int j = 0; j < en.Threads; j++)
+        {
+            searchthread *vthr = &en.sthread[j];
+            if (vthr->lastCompleteDepth && vthr->pos.bestmove.code == hthr->pos.bestmove.code)
+                votes += (U64)(vthr->pos.bestmovescore[0] - minscore + 14) * vthr->lastCompleteDepth;
+        }
+
+        int score = hthr->pos.bestmovescore[0];
+        int bestscore = bestthr->pos.bestmovescore[0];
+        if (hthr == mainthr)
+            bestvotes = votes;
+        else if (MATEFORME(bestscore) && bestthr->lastCompleteDepth)
+        {
+            // already a proven win; only a faster one is better
+            if (score > bestscore)
+                bestthr = hthr;
+        }
+        else if (MATEFORME(score) || (!MATEFOROPPONENT(score) && votes > bestvotes))
+        {
+            bestthr = hthr;
+            bestvotes = votes;
+        }
+    }
+
+    return bestthr;
+}
+
+
+// Publish the best move of a completed helper iteration if it is deeper than the current hint
+static void publishRootHint(int depth, uint32_t movecode)
+{
+    U64 hint = ((U64)depth << 32) | movecode;
+    U64 oldhint = en.rootHint.load(memory_order_relaxed);
+    while ((int)(oldhint >> 32) < depth && !en.rootHint.compare_exchange_weak(oldhint, hint, memory_order_relaxed))
+        ;
+}
+
+
 template <RootsearchType RT>
 static void search_gen1(searchthread *thr)
 {
@@ -1299,6 +1457,8 @@ static void search_gen1(searchthread *thr)
             {
                 inWindow = 1;
                 thr->lastCompleteDepth = thr->depth;
+                if (!isMainThread && pos->bestmove.code)
+                    publishRootHint(thr->depth, pos->bestmove.code);
                 if (score >= en.terminationscore)
                 {
                     // bench mode reached needed score
@@ -1455,19 +1615,7 @@ static void search_gen1(searchthread *thr)
         printf("info string stop info last movetime: %4.3f    full-it. / immediate:  %4d /%4d\n", (nowtime - en.starttime) / (double)en.frequency, en.t1stop, en.t2stop);
 #endif
         // Output of best move
-        searchthread *bestthr = thr;
-        int bestscore = bestthr->pos.bestmovescore[0];
-        for (int i = 1; i < en.Threads; i++)
-        {
-            // search for a better score in the other threads
-            searchthread *hthr = &en.sthread[i];
-            if (hthr->lastCompleteDepth >= bestthr->lastCompleteDepth
-                && hthr->pos.bestmovescore[0] > bestscore)
-            {
-                bestscore = hthr->pos.bestmovescore[0];
-                bestthr = hthr;
-            }
-        }
+        searchthread *bestthr = selectBestThread(thr);
         if (pos->bestmove.code != bestthr->pos.bestmove.code)
         {
             // copy best moves and score from best thread to thread 0
@@ -1527,7 +1675,8 @@ static void search_gen1(searchthread *thr)
         en.benchdepth = thr->depth - 1;
 
 #ifdef STATISTICS
-        search_statistics();
+        if (en.collectStatistics)
+            search_statistics();
 #endif
     }
 }
@@ -1611,12 +1760,14 @@ void searchStart()
     // increment generation counter for tt aging
     tp.nextSearch();
 
+    // no root move hint of the helper threads yet
+    en.rootHint.store(0, memory_order_relaxed);
+
+    // wake up the idle search threads
     if (en.MultiPV == 1)
-        for (int tnum = 0; tnum < en.Threads; tnum++)
-            en.sthread[tnum].thr = thread(&search_gen1<SinglePVSearch>, &en.sthread[tnum]);
+        en.runOnThreads(&search_gen1<SinglePVSearch>);
     else
-        for (int tnum = 0; tnum < en.Threads; tnum++)
-            en.sthread[tnum].thr = thread(&search_gen1<MultiPVSearch>, &en.sthread[tnum]);
+        en.runOnThreads(&search_gen1<MultiPVSearch>);
 }
 
 
@@ -1628,15 +1779,24 @@ void searchWaitStop(bool forceStop)
     // Make the other threads stop now
     if (forceStop)
         en.stopLevel = ENGINESTOPIMMEDIATELY;
-    for (int tnum = 0; tnum < en.Threads; tnum++)
-        if (en.sthread[tnum].thr.joinable())
-            en.sthread[tnum].thr.join();
+    en.waitForThreads();
     en.stopLevel = ENGINETERMINATEDSEARCH;
 }
 
 
 inline void chessposition::CheckForImmediateStop()
 {
+    if (nodes & NODESPERPUBLISH)
+        return;
+
+    // Publish the nodes in batches; the global count is behind by less than Threads * batch size
+    U64 totalnodes = en.publishedNodes.fetch_add(NODESPERPUBLISH + 1, memory_order_relaxed) + NODESPERPUBLISH + 1;
+    if (en.maxnodes && en.maxnodes <= totalnodes && en.pondersearch != PONDERING && en.stopLevel < ENGINESTOPIMMEDIATELY)
+    {
+        en.stopLevel = ENGINESTOPIMMEDIATELY;
+        return;
+    }
+
     if (threadindex || (nodes & NODESPERCHECK))
         return;
 
@@ -1659,12 +1819,6 @@ inline void chessposition::CheckForImmediateStop()
         en.stopLevel = ENGINESTOPIMMEDIATELY;
         return;
     }
-
-    if (en.maxnodes && en.maxnodes <= en.getTotalNodes() && en.stopLevel < ENGINESTOPIMMEDIATELY)
-    {
-        en.stopLevel = ENGINESTOPIMMEDIATELY;
-        return;
-    }
 }
 
 
@@ -1675,6 +1829,17 @@ void search_statistics()
     U64 n, i1, i2, i3;
     double f0, f1, f2, f3, f4, f5, f6, f7, f10, f11;
 
+    // sum up the counters of all threads; the helpers may still finish their last nodes so this is a snapshot
+    static_assert(sizeof(statistic) % sizeof(U64) == 0, "statistic counters must be 64bit");
+    statistic statistics = {};
+    U64 *sum = (U64*)&statistics;
+    for (int i = 0; i < en.Threads; i++)
+    {
+        U64 *counter = (U64*)&en.sthread[i].pos.statistics;
+        for (size_t j = 0; j < sizeof(statistic) / sizeof(U64); j++)
+            sum[j] += counter[j];
+    }
+
     printf("(ST)====Statistics====================================================================================================================================\n");
 
     // quiescense search statistics
@@ -20,8 +20,36 @@
 
 #if defined(__linux__) && !defined(__ANDROID__)
 static const size_t HashAlignBytes = 2ull << 20;
-#include <sys/mman.h> // madvise
+static const size_t HugePage1GBytes = 1ull << 30;
+#include <sys/mman.h> // madvise, mmap
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
 #endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+// Try to get explicitly reserved huge pages (see /proc/sys/vm/nr_hugepages); returns nullptr if there are not enough
+static void* allocHugetlb(size_t size, int pageflag)
+{
+    void *mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | pageflag, -1, 0);
+    return (mem == MAP_FAILED ? nullptr : mem);
+}
+
+static bool thpDisabled()
+{
+    string line = "";
+    ifstream f("/sys/kernel/mm/transparent_hugepage/enabled");
+    if (f.is_open())
+        getline(f, line);
+    return (line == "" || line.find("[never]") != string::npos);
+}
+#endif
+
+static const char *strTtBacking[] = { "normal pages", "transparent huge pages", "2MB huge pages", "1GB huge pages" };
 
 /* A small noncryptographic PRNG */
 /* http://www.burtleburtle.net/bob/rand/smallprng.html */
@@ -147,151 +175,476 @@ u8 zobrist::getMaterialHash(chessposition *pos)
 }
 
 
-transposition::~transposition()
+static void freeHashMemory(void *mem, size_t allocsize, int backing)
+{
+#if defined(__linux__) && !defined(__ANDROID__)
+    if (backing == TTBACKINGHUGE2M || backing == TTBACKINGHUGE1G)
+        munmap(mem, allocsize);
+    else
+#endif
+        freealigned64(mem);
+}
+
+// Value of an entry for the replacement scheme; entries of older searches lose value
+static inline int replaceValue(transpositionentry *e, int numOfSearchShiftTwo)
+{
+    return e->depth - ((259 + numOfSearchShiftTwo - e->boundAndAge) & 0xfc) * 2;
+}
+
+
+// Jobs on the hash table that run in parallel on the search threads.
+// As the threads are bound to their NUMA node, each part of the table is first touched by the node that cleaned it.
+static void *hashJobTable;
+
+template <int BucketNum>
+static void hashJob(searchthread *thr)
+{
+    ((transposition_t<BucketNum>*)hashJobTable)->doJobSlice(thr->index, en.Threads);
+}
+
+template <int BucketNum>
+void transposition_t<BucketNum>::runJob(int job)
+{
+    jobType = job;
+    if (en.sthread && en.Threads > 1 && en.stopLevel == ENGINETERMINATEDSEARCH)
+    {
+        hashJobTable = this;
+        en.runOnThreads(&hashJob<BucketNum>);
+        en.waitForThreads();
+    }
+    else
+    {
+        // No threads to help or search is running
+        doJobSlice(0, 1);
+    }
+}
+
+template <int BucketNum>
+void transposition_t<BucketNum>::doJobSlice(int index, int num)
+{
+    U64 first = size * index / num;
+    U64 last = size * (index + 1) / num;
+
+    if (jobType == TTJOBCLEAN)
+    {
+        memset((void*)&table[first], 0, (last - first) * sizeof(transpositioncluster_t<BucketNum>));
+        return;
+    }
+
+    // TTJOBTRANSFER: Fill the new clusters with the most valuable entries of the old clusters folding into them
+    // Only used for shrinking (or same size) so every old entry has exactly one new cluster
+    U64 sources = oldsize / size;
+    for (U64 j = first; j < last; j++)
+    {
+        transpositioncluster_t<BucketNum> *cluster = &table[j];
+        memset((void*)cluster, 0, sizeof(transpositioncluster_t<BucketNum>));
+        int used = 0;
+        for (U64 m = 0; m < sources; m++)
+        {
+            transpositioncluster_t<BucketNum> *oldcluster = &oldtable[j + m * size];
+            for (int k = 0; k < BucketNum; k++)
+            {
+                transpositionentry e;
+                hashupper_t key = oldcluster->load(k, &e);
+                if (!key)
+                    continue;
+                int value = replaceValue(&e, numOfSearchShiftTwo);
+                int target = -1;
+                transpositionentry ce;
+                for (int i = 0; i < used; i++)
+                {
+                    if (cluster->load(i, &ce) == key)
+                    {
+                        // same key from different old clusters; keep only the more valuable one
+                        target = (replaceValue(&ce, numOfSearchShiftTwo) < value ? i : BucketNum);
+                        break;
+                    }
+                }
+                if (target == BucketNum)
+                    continue;
+                if (target < 0)
+                {
+                    if (used < BucketNum)
+                    {
+                        target = used++;
+                    }
+                    else
+                    {
+                        // replace the least valuable entry if the old one is better
+                        int leastValue = value;
+                        for (int i = 0; i < BucketNum; i++)
+                        {
+                            cluster->load(i, &ce);
+                            if (replaceValue(&ce, numOfSearchShiftTwo) < leastValue)
+                            {
+                                leastValue = replaceValue(&ce, numOfSearchShiftTwo);
+                                target = i;
+                            }
+                        }
+                        if (target < 0)
+                            continue;
+                    }
+                }
+                cluster->store(target, key, &e);
+            }
+        }
+    }
+}
+
+
+template <int BucketNum>
+transposition_t<BucketNum>::~transposition_t()
 {
-    if (size > 0)
-        freealigned64(table);
+    freeTable();
+}
+
+template <int BucketNum>
+void transposition_t<BucketNum>::freeTable()
+{
+    if (size == 0)
+        return;
+    freeHashMemory(table, allocsize, backing);
+    table = nullptr;
+    size = 0;
+    sizemask = 0;
 }
 
-int transposition::setSize(int sizeMb)
+template <int BucketNum>
+int transposition_t<BucketNum>::setSize(int sizeMb)
 {
     int restMb = 0;
     int msb = 0;
-    if (size > 0)
-        freealigned64(table);
-    size_t clustersize = sizeof(transpositioncluster);
+    size_t clustersize = sizeof(transpositioncluster_t<BucketNum>);
 #ifdef SDEBUG
     // Don't use the debugging part of the cluster for calculation of size to get consistent search with non SDEBUG
-    clustersize = offsetof(transpositioncluster, debugHash);
+    clustersize = offsetof(transpositioncluster_t<BucketNum>, debugHash);
 #endif
     U64 maxsize = ((U64)sizeMb << 20) / clustersize;
-    if (!maxsize) return 0;
-    GETMSB(msb, maxsize);
-    size = (1ULL << msb);
-    restMb = (int)(((maxsize ^ size) >> 20) * clustersize);  // return rest for pawnhash
-    sizemask = size - 1;
-    size_t allocsize = (size_t)(size * sizeof(transpositioncluster));
+    if (!maxsize)
+    {
+        freeTable();
+        return 0;
+    }
 
-#if defined(__linux__) && !defined(__ANDROID__) // Many thanks to Sami Kiminki for advise on the huge page theory and for this patch
-    // Round up hashSize to the next 2M for alignment
-    allocsize = ((allocsize + HashAlignBytes - 1u) / HashAlignBytes) * HashAlignBytes;
+    GETMSB(msb, maxsize);
+    U64 newsize = (1ULL << msb);
+    restMb = (int)(((maxsize ^ newsize) >> 20) * clustersize);  // return rest for pawnhash
 
-    table = (transpositioncluster*)aligned_alloc(HashAlignBytes, allocsize);
+    oldtable = table;
+    oldsize = size;
+    size_t oldallocsize = allocsize;
+    int oldbacking = backing;
 
-    // Linux-specific call to request huge pages, in case the aligned_alloc()
-    // call above doesn't already trigger them (depends on transparent huge page
-    // settings)
-    madvise(table, allocsize, MADV_HUGEPAGE);
-#else
-    table = (transpositioncluster*)allocalign64(allocsize);
-#endif
+    if (oldsize && oldsize >= newsize && allocTable(newsize))
+    {
+        // Rehash the old entries in parallel and release the old table
+        runJob(TTJOBTRANSFER);
+        freeHashMemory(oldtable, oldallocsize, oldbacking);
+        resetStatistics();
+    }
+    else
+    {
+        // Growing can't restore the missing index bits of the old entries and both tables may not fit into memory;
+        // so release the old table first and start with an empty one
+        if (oldsize)
+            freeHashMemory(oldtable, oldallocsize, oldbacking);
+        table = nullptr;
+        size = 0;
+        sizemask = 0;
+        while (!allocTable(newsize))
+        {
+            newsize >>= 1;
+            if (!newsize)
+            {
+                cout << "info string Hash: Cannot allocate memory for the hash table.\n";
+                oldtable = nullptr;
+                oldsize = 0;
+                return 0;
+            }
+            cout << "info string Hash: Not enough memory. Trying " << ((newsize * sizeof(transpositioncluster_t<BucketNum>)) >> 20) << " MB.\n";
+        }
+        clean();
+    }
+    oldtable = nullptr;
+    oldsize = 0;
 
-    clean();
     return restMb;
 }
 
-void transposition::clean()
+
+template <int BucketNum>
+bool transposition_t<BucketNum>::allocTable(U64 newsize)
 {
-    size_t totalsize = size * sizeof(transpositioncluster);
-    size_t sizePerThread = totalsize / en.Threads;
-    thread tthread[MAXTHREADS];
-    for (int i = 0; i < en.Threads; i++)
+    size_t newallocsize = (size_t)(newsize * sizeof(transpositioncluster_t<BucketNum>));
+    int newbacking = TTBACKINGPLAIN;
+    transpositioncluster_t<BucketNum> *newtable = nullptr;
+
+#if defined(__linux__) && !defined(__ANDROID__) // Many thanks to Sami Kiminki for advise on the huge page theory and for this patch
+    // First try explicit huge pages; 1GB pages only if the table fills them
+    if (newallocsize >= HugePage1GBytes)
     {
-        void *start = (char*)table + i * sizePerThread;
-        tthread[i] = thread(memset, start, 0, sizePerThread);
+        size_t hugesize = ((newallocsize + HugePage1GBytes - 1u) / HugePage1GBytes) * HugePage1GBytes;
+        if ((newtable = (transpositioncluster_t<BucketNum>*)allocHugetlb(hugesize, MAP_HUGE_1GB)))
+        {
+            newallocsize = hugesize;
+            newbacking = TTBACKINGHUGE1G;
+        }
     }
-    memset((char*)table + en.Threads * sizePerThread, 0, totalsize - en.Threads * sizePerThread);
-    for (int i = 0; i < en.Threads; i++)
+
+    // Round up hashSize to the next 2M for alignment
+    newallocsize = ((newallocsize + HashAlignBytes - 1u) / HashAlignBytes) * HashAlignBytes;
+
+    if (!newtable && (newtable = (transpositioncluster_t<BucketNum>*)allocHugetlb(newallocsize, MAP_HUGE_2MB)))
+        newbacking = TTBACKINGHUGE2M;
+
+    if (!newtable)
     {
-        if (tthread[i].joinable())
-            tthread[i].join();
+        newtable = (transpositioncluster_t<BucketNum>*)aligned_alloc(HashAlignBytes, newallocsize);
+
+        // Linux-specific call to request huge pages, in case the aligned_alloc()
+        // call above doesn't already trigger them (depends on transparent huge page
+        // settings)
+        if (newtable && madvise(newtable, newallocsize, MADV_HUGEPAGE) == 0 && !thpDisabled())
+            newbacking = TTBACKINGTHP;
     }
+#else
+    newtable = (transpositioncluster_t<BucketNum>*)allocalign64(newallocsize);
+#endif
+
+    if (!newtable)
+        return false;
+
+    table = newtable;
+    size = newsize;
+    sizemask = size - 1;
+    allocsize = newallocsize;
+    backing = newbacking;
+
+    cout << "info string Hash: " << (allocsize >> 20) << " MB allocated using " << strTtBacking[backing] << ".\n";
+
+    // Spread the hash over all NUMA nodes before the pages are touched
+    if (en.numaInterleaveHash)
+        en.numa.interleaveMemory(table, allocsize);
+
+    return true;
+}
+
+template <int BucketNum>
+void transposition_t<BucketNum>::clean()
+{
+    if (size)
+        runJob(TTJOBCLEAN);
     numOfSearchShiftTwo = 0;
+    resetStatistics();
 }
 
 
-unsigned int transposition::getUsedinPermill()
+template <int BucketNum>
+unsigned int transposition_t<BucketNum>::getUsedinPermill()
 {
     unsigned int used = 0;
+    if (!size)
+        return 0;
 
     // Take 1000 samples
-    for (int i = 0; i < 1000 / TTBUCKETNUM; i++)
-        for (int j = 0; j < TTBUCKETNUM; j++)
-            if ((table[i].entry[j].boundAndAge & 0xfc) == numOfSearchShiftTwo)
+    for (int i = 0; i < 1000 / BucketNum; i++)
+        for (int j = 0; j < BucketNum; j++)
+        {
+            transpositionentry e;
+            table[i].load(j, &e);
+            if ((e.boundAndAge & 0xfc) == numOfSearchShiftTwo)
                 used++;
+        }
 
     return used;
 }
 
 
-void transposition::addHash(U64 hash, int val, int16_t staticeval, int bound, int depth, uint16_t movecode)
+// Header of the hash file; the clusters follow as they are in memory
+#define HASHFILEMAGIC "RubiHash"
+#define HASHFILEVERSION 2
+#define HASHFILECHUNKSIZE (64ULL << 20)
+
+struct hashfileheader {
+    char magic[8];
+    uint32_t version;
+    uint32_t clustersize;
+    uint32_t bucketnum;
+    uint32_t numOfSearchShiftTwo;
+    U64 size;
+};
+
+
+template <int BucketNum>
+bool transposition_t<BucketNum>::saveToFile(string filename)
+{
+    if (!size)
+        return false;
+
+    ofstream os(filename, ios::binary);
+    if (!os.is_open())
+        return false;
+
+    hashfileheader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, HASHFILEMAGIC, sizeof(h.magic));
+    h.version = HASHFILEVERSION;
+    h.clustersize = sizeof(transpositioncluster_t<BucketNum>);
+    h.bucketnum = BucketNum;
+    h.numOfSearchShiftTwo = numOfSearchShiftTwo;
+    h.size = size;
+    os.write((char*)&h, sizeof(h));
+
+    // write the whole table in big chunks
+    char *data = (char*)table;
+    U64 remaining = size * sizeof(transpositioncluster_t<BucketNum>);
+    while (remaining && os.good())
+    {
+        U64 chunk = min(remaining, HASHFILECHUNKSIZE);
+        os.write(data, chunk);
+        data += chunk;
+        remaining -= chunk;
+    }
+
+    return os.good();
+}
+
+
+template <int BucketNum>
+bool transposition_t<BucketNum>::loadFromFile(string filename)
+{
+    ifstream is(filename, ios::binary);
+    if (!is.is_open())
+        return false;
+
+    hashfileheader h;
+    is.read((char*)&h, sizeof(h));
+    if (!is.good() || memcmp(h.magic, HASHFILEMAGIC, sizeof(h.magic)) || h.version != HASHFILEVERSION
+        || h.clustersize != sizeof(transpositioncluster_t<BucketNum>) || h.bucketnum != BucketNum || !h.size || (h.size & (h.size - 1)))
+        return false;
+
+    if (h.size != size)
+    {
+        // resize the table to the size of the saved one; no need to keep the old entries
+        freeTable();
+        setSize((int)((h.size * sizeof(transpositioncluster_t<BucketNum>)) >> 20));
+        if (h.size != size)
+            return false;
+    }
+
+    char *data = (char*)table;
+    U64 remaining = size * sizeof(transpositioncluster_t<BucketNum>);
+    while (remaining && is.good())
+    {
+        U64 chunk = min(remaining, HASHFILECHUNKSIZE);
+        is.read(data, chunk);
+        data += chunk;
+        remaining -= chunk;
+    }
+
+    if (!is.good())
+    {
+        // incomplete file; don't use the garbage
+        clean();
+        return false;
+    }
+
+    numOfSearchShiftTwo = h.numOfSearchShiftTwo;
+    return true;
+}
+
+
+template <int BucketNum>
+void transposition_t<BucketNum>::addHash(U64 hash, int val, int16_t staticeval, int bound, int depth, uint16_t movecode)
 {
+    // no table after a failed allocation
+    if (!size)
+        return;
+
     unsigned long long index = hash & sizemask;
-    transpositioncluster *cluster = &table[index];
-    transpositionentry *e;
-    transpositionentry *leastValuableEntry;
+    transpositioncluster_t<BucketNum> *cluster = &table[index];
+    hashupper_t hashupper = GETHASHUPPER(hash);
+    transpositionentry e[BucketNum];
+    hashupper_t key[BucketNum];
+    int leastValuable = 0;
 
-    for (int i = 0; i < TTBUCKETNUM; i++)
+    for (int i = 0; i < BucketNum; i++)
     {
         // First try to find a free or matching entry
-        e = &(cluster->entry[i]);
-        if (cluster->entry[i].hashupper == GETHASHUPPER(hash) || !cluster->entry[i].hashupper)
+        key[i] = cluster->load(i, &e[i]);
+        if (key[i] == hashupper || !key[i])
         {
-            leastValuableEntry = e;
+            leastValuable = i;
             break;
         }
 
         if (i == 0)
-        {
-            // initialize leastValuableEntry
-            leastValuableEntry = e;
+            // initialize leastValuable
             continue;
-        }
 
-        if (e->depth - ((259 + numOfSearchShiftTwo - e->boundAndAge) & 0xfc) * 2
-            < leastValuableEntry->depth - ((259 + numOfSearchShiftTwo - leastValuableEntry->boundAndAge) & 0xfc) * 2)
+        if (e[i].depth - ((259 + numOfSearchShiftTwo - e[i].boundAndAge) & 0xfc) * 2
+            < e[leastValuable].depth - ((259 + numOfSearchShiftTwo - e[leastValuable].boundAndAge) & 0xfc) * 2)
         {
             // found a new less valuable entry
-            leastValuableEntry = e;
+            leastValuable = i;
         }
     }
 
     // Don't overwrite an entry from the same position, unless we have
     // an exact bound or depth that is nearly as good as the old one
     if (bound != HASHEXACT
-        &&  leastValuableEntry->hashupper == GETHASHUPPER(hash)
-        &&  depth < leastValuableEntry->depth - 3)
+        &&  key[leastValuable] == hashupper
+        &&  depth < e[leastValuable].depth - 3)
+    {
+        TTSTATSINC(storesRefused);
         return;
+    }
+
+#ifdef STATISTICS
+    ttstats->stores++;
+    if (!key[leastValuable])
+        ttstats->storesEmpty++;
+    else if (key[leastValuable] == hashupper)
+        ttstats->storesUpdate++;
+    else
+        ttstats->storesReplace++;
+#endif
 
-    leastValuableEntry->hashupper = GETHASHUPPER(hash);
 #ifdef SDEBUG
-    if (cluster->debugHash && (uint32_t)(cluster->debugHash >> 32) == leastValuableEntry->hashupper)
+    if (cluster->debugHash && (uint32_t)(cluster->debugHash >> 32) == hashupper)
         cluster->debugStoredBy = "";
 
 #endif
-    leastValuableEntry->depth = (uint8_t)depth;
-    leastValuableEntry->value = (short)val;
-    leastValuableEntry->boundAndAge = (uint8_t)(bound | numOfSearchShiftTwo);
-    leastValuableEntry->movecode = movecode;
-    leastValuableEntry->staticeval = staticeval;
+    transpositionentry newentry;
+    newentry.depth = (uint8_t)depth;
+    newentry.value = (short)val;
+    newentry.boundAndAge = (uint8_t)(bound | numOfSearchShiftTwo);
+    newentry.movecode = movecode;
+    newentry.staticeval = staticeval;
+    cluster->store(leastValuable, hashupper, &newentry);
 }
 
 
-void transposition::printHashentry(U64 hash)
+template <int BucketNum>
+void transposition_t<BucketNum>::printHashentry(U64 hash)
 {
+    if (!size)
+        return;
     unsigned long long index = hash & sizemask;
-    transpositioncluster *data = &table[index];
+    transpositioncluster_t<BucketNum> *data = &table[index];
     printf("Hashentry for %llx\n", hash);
-    for (int i = 0; i < TTBUCKETNUM; i++)
+    for (int i = 0; i < BucketNum; i++)
     {
-        if ((data->entry[i].hashupper) == GETHASHUPPER(hash))
+        transpositionentry e;
+        hashupper_t key = data->load(i, &e);
+        if (key == GETHASHUPPER(hash))
         {
-            printf("Match in upper part: %x / %x\n", (unsigned int)data->entry[i].hashupper, (unsigned int)(hash >> 32));
-            printf("Move code: %x\n", (unsigned int)data->entry[i].movecode);
-            printf("Depth:     %d\n", data->entry[i].depth);
-            printf("Value:     %d\n", data->entry[i].value);
-            printf("Eval:      %d\n", data->entry[i].staticeval);
-            printf("BoundAge:  %d\n", data->entry[i].boundAndAge);
+            printf("Match in upper part: %x / %x\n", (unsigned int)key, (unsigned int)(hash >> 32));
+            printf("Move code: %x\n", (unsigned int)e.movecode);
+            printf("Depth:     %d\n", e.depth);
+            printf("Value:     %d\n", e.value);
+            printf("Eval:      %d\n", e.staticeval);
+            printf("BoundAge:  %d\n", e.boundAndAge);
             return;
         }
     }
@@ -299,37 +652,42 @@ void transposition::printHashentry(U64 hash)
 }
 
 
-bool transposition::probeHash(U64 hash, int *val, int *staticeval, uint16_t *movecode, int depth, int alpha, int beta, int ply)
+template <int BucketNum>
+bool transposition_t<BucketNum>::probeHash(U64 hash, int *val, int *staticeval, uint16_t *movecode, int depth, int alpha, int beta, int ply)
 {
 #ifdef EVALTUNE
     // don't use transposition table when tuning evaluation
     return false;
 #endif
+    if (!size)
+        return false;
     unsigned long long index = hash & sizemask;
-    transpositioncluster* data = &table[index];
-    for (int i = 0; i < TTBUCKETNUM; i++)
+    transpositioncluster_t<BucketNum>* data = &table[index];
+    TTSTATSINC(probes);
+    for (int i = 0; i < BucketNum; i++)
     {
-        transpositionentry *e = &(data->entry[i]);
-        if (e->hashupper == GETHASHUPPER(hash))
+        transpositionentry e;
+        if (data->load(i, &e) == GETHASHUPPER(hash))
         {
-            *movecode = e->movecode;
-            *staticeval = e->staticeval;
-            int bound = (e->boundAndAge & BOUNDMASK);
-            int v = FIXMATESCOREPROBE(e->value, ply);
+            TTSTATSINC(hits);
+            *movecode = e.movecode;
+            *staticeval = e.staticeval;
+            int bound = (e.boundAndAge & BOUNDMASK);
+            int v = FIXMATESCOREPROBE(e.value, ply);
             if (bound == HASHEXACT)
             {
                 *val = v;
-                return (e->depth >= depth);
+                return (e.depth >= depth);
             }
             if (bound == HASHALPHA && v <= alpha)
             {
                 *val = alpha;
-                return (e->depth >= depth);
+                return (e.depth >= depth);
             }
             if (bound == HASHBETA && v >= beta)
             {
                 *val = beta;
-                return (e->depth >= depth);
+                return (e.depth >= depth);
             }
             // value outside boundary
             return false;
@@ -340,14 +698,18 @@ bool transposition::probeHash(U64 hash, int *val, int *staticeval, uint16_t *mov
 }
 
 
-uint16_t transposition::getMoveCode(U64 hash)
+template <int BucketNum>
+uint16_t transposition_t<BucketNum>::getMoveCode(U64 hash)
 {
+    if (!size)
+        return 0;
     unsigned long long index = hash & sizemask;
-    transpositioncluster *data = &table[index];
-    for (int i = 0; i < TTBUCKETNUM; i++)
+    transpositioncluster_t<BucketNum> *data = &table[index];
+    for (int i = 0; i < BucketNum; i++)
     {
-        if ((data->entry[i].hashupper) == GETHASHUPPER(hash))
-            return data->entry[i].movecode;
+        transpositionentry e;
+        if (data->load(i, &e) == GETHASHUPPER(hash))
+            return e.movecode;
     }
     return 0;
 }
@@ -421,4 +783,110 @@ bool  Materialhash::probeHash(U64 hash, Materialhashentry **entry)
 }
 
 
+#ifdef STATISTICS
+// Counters of threads outside the search pool go here
+static ttstatistics ttstatsDummy;
+thread_local ttstatistics *ttstats = &ttstatsDummy;
+#endif
+
+// The counters belong to the current table; restart them when it is cleaned or resized
+template <int BucketNum>
+void transposition_t<BucketNum>::resetStatistics()
+{
+#ifdef STATISTICS
+    for (int i = 0; i < en.oldThreads; i++)
+        memset(&en.sthread[i].ttstats, 0, sizeof(ttstatistics));
+#endif
+}
+
+static string permill(U64 part, U64 total)
+{
+    char s[16];
+    snprintf(s, sizeof(s), "%5.1f%%", total ? 100.0 * part / total : 0.0);
+    return s;
+}
+
+template <int BucketNum>
+void transposition_t<BucketNum>::printStatistics(U64 samples)
+{
+    if (!size)
+        return;
+    if (!samples || samples > size)
+        samples = size;
+    U64 step = size / samples;
+
+    // One pass over the sampled clusters
+    const int agebins = 5;
+    const int depthbins = 9;
+    const int depthbinsize = 4;
+    U64 used = 0;
+    U64 age[agebins] = { 0 };
+    U64 bounds[BOUNDMASK + 1] = { 0 };
+    U64 depths[depthbins] = { 0 };
+    for (U64 i = 0; i < samples; i++)
+    {
+        transpositioncluster_t<BucketNum> *cluster = &table[i * step];
+        for (int j = 0; j < BucketNum; j++)
+        {
+            transpositionentry e;
+            if (!cluster->load(j, &e))
+                continue;
+            used++;
+            age[min(agebins - 1, ((259 + numOfSearchShiftTwo - e.boundAndAge) & 0xfc) >> 2)]++;
+            bounds[e.boundAndAge & BOUNDMASK]++;
+            depths[min(depthbins - 1, e.depth / depthbinsize)]++;
+        }
+    }
+    U64 entries = samples * BucketNum;
+
+    printf("Hash statistics: %llu of %llu clusters sampled (%d entries each)\n", samples, size, BucketNum);
+    printf("Occupancy:   used %s   this search %s   1 ago %s   2 ago %s   3 ago %s   older %s\n",
+        permill(used, entries).c_str(), permill(age[0], entries).c_str(), permill(age[1], entries).c_str(),
+        permill(age[2], entries).c_str(), permill(age[3], entries).c_str(), permill(age[4], entries).c_str());
+    printf("Bounds:      exact %s   upper %s   lower %s\n",
+        permill(bounds[HASHEXACT], used).c_str(), permill(bounds[HASHALPHA], used).c_str(), permill(bounds[HASHBETA], used).c_str());
+    printf("Depth:      ");
+    for (int i = 0; i < depthbins; i++)
+    {
+        string range = to_string(i * depthbinsize) + (i < depthbins - 1 ? "-" + to_string((i + 1) * depthbinsize - 1) : "+");
+        printf(" %5s %s", range.c_str(), permill(depths[i], used).c_str());
+    }
+    printf("\n");
+
+#ifdef STATISTICS
+    // Aggregate the counters of the threads
+    ttstatistics total;
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i < en.Threads; i++)
+    {
+        ttstatistics *ts = &en.sthread[i].ttstats;
+        total.probes += ts->probes;
+        total.hits += ts->hits;
+        total.stores += ts->stores;
+        total.storesEmpty += ts->storesEmpty;
+        total.storesUpdate += ts->storesUpdate;
+        total.storesReplace += ts->storesReplace;
+        total.storesRefused += ts->storesRefused;
+        total.badMoves += ts->badMoves;
+    }
+
+    // Every used entry of a cluster matches a foreign position with probability 2^-16
+    double expectedCollisions = (double)total.probes * used / samples / (1 << (sizeof(hashupper_t) * 8));
+
+    printf("Probes:      %llu   hits %llu (%s)   misses %llu\n",
+        total.probes, total.hits, permill(total.hits, total.probes).c_str(), total.probes - total.hits);
+    printf("Stores:      %llu   empty slot %llu   same position %llu   replaced other %llu (%s)   refused %llu\n",
+        total.stores, total.storesEmpty, total.storesUpdate, total.storesReplace, permill(total.storesReplace, total.stores).c_str(), total.storesRefused);
+    printf("Collisions:  detected %llu (invalid hash move)   expected %.0f (%.2f per million probes)\n",
+        total.badMoves, expectedCollisions, total.probes ? expectedCollisions * 1e6 / total.probes : 0.0);
+#else
+    printf("Probe, store and collision counters are only collected in builds with STATISTICS.\n");
+#endif
+}
+
+
+// Explicit template instantiation
+// This avoids putting these definitions in header file
+template class transposition_t<TTBUCKETNUM>;
+
 transposition tp;
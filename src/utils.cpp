@@ -277,6 +277,16 @@ string AlgebraicFromShort(string s, chessposition *pos)
 }
 
 
+string compilerinfo::PrintCpuFeatures(U64 f, bool onlyHighest)
+{
+    string s = "";
+    for (int i = 0; f; i++, f = f >> 1)
+        if (f & 1) s = (onlyHighest ? "" : ((s != "") ? s + " " : "")) + strCpuFeatures[i];
+
+    return s;
+}
+
+
 #if defined(_M_X64) || defined(__amd64)
 
 #if defined _MSC_VER && !defined(__clang_major__)
@@ -292,15 +302,6 @@ static void cpuid(int32_t out[4], int32_t x) {
 #endif
 
 
-string compilerinfo::PrintCpuFeatures(U64 f, bool onlyHighest)
-{
-    string s = "";
-    for (int i = 0; f; i++, f = f >> 1)
-        if (f & 1) s = (onlyHighest ? "" : ((s != "") ? s + " " : "")) + strCpuFeatures[i];
-
-    return s;
-}
-
 void compilerinfo::GetSystemInfo()
 {
     machineSupports = 0ULL;
@@ -347,6 +348,10 @@ void compilerinfo::GetSystemInfo()
         {
             if (CPUInfo[1] & (1 <<  8)) machineSupports |= CPUBMI2;
             if (CPUInfo[1] & (1 <<  5)) machineSupports |= CPUAVX2;
+            // AVX-512 foundation and byte/word instructions
+            if ((CPUInfo[1] & (1 << 16)) && (CPUInfo[1] & (1 << 30))) machineSupports |= CPUAVX512;
+            // AVX-512 VNNI; the 256bit variants need the vector length extension
+            if ((CPUInfo[2] & (1 << 11)) && (CPUInfo[1] & (1u << 31))) machineSupports |= CPUVNNI;
         }
     }
 
@@ -399,14 +404,163 @@ void compilerinfo::GetSystemInfo()
 }
 
 #else
+
+#if defined(__linux__) && (defined(__aarch64__) || defined(__arm__))
+#include <sys/auxv.h>
+#endif
+#if defined(__APPLE__) && defined(__aarch64__)
+#include <sys/sysctl.h>
+#endif
+
 void compilerinfo::GetSystemInfo()
 {
+    machineSupports = 0ULL;
+    cpuVendor = CPUVENDORUNKNOWN;
+
+#if defined(__aarch64__)
+    system = "ARM 64bit platform";
+    // Advanced SIMD is mandatory for ARMv8-A
+    machineSupports |= CPUNEON;
+#if defined(__linux__)
+    // HWCAP_ASIMDDP
+    if (getauxval(AT_HWCAP) & (1 << 20)) machineSupports |= CPUDOTPROD;
+#elif defined(__APPLE__)
+    int dotprod = 0;
+    size_t len = sizeof(dotprod);
+    if (sysctlbyname("hw.optional.arm.FEAT_DotProd", &dotprod, &len, NULL, 0) == 0 && dotprod) machineSupports |= CPUDOTPROD;
+#else
+    // no way to ask the system; trust the binary
+    machineSupports |= binarySupports & CPUDOTPROD;
+#endif
+
+#elif defined(__arm__)
+    system = "ARM 32bit platform";
+#if defined(__linux__)
+    // HWCAP_NEON
+    if (getauxval(AT_HWCAP) & (1 << 12)) machineSupports |= CPUNEON;
+#else
+    machineSupports |= binarySupports & CPUNEON;
+#endif
+
+#else
     system = "Some non-x86-64 platform.";
+    machineSupports = binarySupports;
+#endif
+
+    U64 notSupported = binarySupports & ~machineSupports;
+    if (notSupported)
+    {
+        cout << "info string Error! Binary is not compatible with this machine. Missing cpu features:";
+        cout << PrintCpuFeatures(notSupported) << ". Please use correct binary.\n";
+        exit(0);
+    }
+
+    U64 supportedButunused = machineSupports & ~binarySupports;
+    if (supportedButunused)
+    {
+        cout << "info string Warning! Binary not optimal for this machine. Unused cpu features:";
+        cout << PrintCpuFeatures(supportedButunused) << ". Please use correct binary for best performance.\n";
+    }
 }
+#endif
 
-string compilerinfo::PrintCpuFeatures(U64 f, bool onlyHighest)
+
+#if defined(__linux__) && !defined(__ANDROID__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define MPOL_INTERLEAVE 3
+
+// Parse lists like "0-3,8-11" as used in /sys/devices/system/node
+static vector<int> parseCpuList(string s)
+{
+    vector<int> list;
+    istringstream iss(s);
+    string range;
+    while (getline(iss, range, ','))
+    {
+        size_t dash = range.find('-');
+        try {
+            int first = stoi(range.substr(0, dash));
+            int last = (dash == string::npos ? first : stoi(range.substr(dash + 1)));
+            for (int i = first; i <= last; i++)
+                list.push_back(i);
+        }
+        catch (...) {}
+    }
+    return list;
+}
+
+static string readSysFile(string filename)
+{
+    string line = "";
+    ifstream f(filename);
+    if (f.is_open())
+        getline(f, line);
+    return line;
+}
+
+void numasystem::init()
+{
+    numOfNodes = 0;
+    nodeId.clear();
+    nodeCpus.clear();
+    vector<int> nodes = parseCpuList(readSysFile("/sys/devices/system/node/online"));
+    for (int n : nodes)
+    {
+        vector<int> cpus = parseCpuList(readSysFile("/sys/devices/system/node/node" + to_string(n) + "/cpulist"));
+        if (!cpus.size())
+            // memory-only node
+            continue;
+        nodeId.push_back(n);
+        nodeCpus.push_back(cpus);
+        numOfNodes++;
+    }
+}
+
+bool numasystem::bindThread(int index)
+{
+    if (numOfNodes < 2)
+        return false;
+
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    for (int cpu : nodeCpus[nodeOfThread(index)])
+        CPU_SET(cpu, &cpuset);
+
+    return (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset) == 0);
+}
+
+bool numasystem::interleaveMemory(void *mem, size_t size)
+{
+    if (numOfNodes < 2)
+        return false;
+
+    unsigned long nodemask = 0;
+    for (int n : nodeId)
+        if (n < (int)sizeof(nodemask) * 8)
+            nodemask |= 1UL << n;
+
+    // No libnuma dependency; just set the policy for the pages not touched yet
+    return (syscall(SYS_mbind, mem, size, MPOL_INTERLEAVE, &nodemask, sizeof(nodemask) * 8, 0) == 0);
+}
+
+#else
+void numasystem::init()
+{
+    numOfNodes = 0;
+}
+
+bool numasystem::bindThread(int)
+{
+    return false;
+}
+
+bool numasystem::interleaveMemory(void*, size_t)
 {
-    return onlyHighest ? "" : "unknown";
+    return false;
 }
 #endif
 